@@ -0,0 +1,490 @@
+/**
+ * benchmark driver. runs every reader over the same file, repeats the runs,
+ * drops the page cache between them and collects the readers' csv records.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <wordexp.h>
+
+#include "bench.h"
+
+#define MAX_ENGINES 32
+#define MAX_BLOCK_SIZES 16
+#define WAL_SUFFIX ".wal" // writers write filename + WAL_SUFFIX, removed after the runs
+
+/**
+ * readers run by default, relative to the directory of this binary
+ */
+static const char *default_engines[] = {
+    "posix_read",
+    "liburing_read",
+    "io_uring_sqpoll",
+};
+
+struct run_record {
+    char engine[256];   // engine name reported by the reader
+    size_t block_size;  // bytes per request
+    size_t bytes;       // bytes read
+    size_t ops;         // completed requests
+    uint64_t elapsed_ns;
+    double mbps;        // throughput
+    double iops;        // requests per second
+    double p50_us;      // latency percentiles
+    double p99_us;
+    double p999_us;
+    double cpu_s;       // user + system time of the reader, including its kernel sq threads
+};
+
+/**
+ * programs that write their file instead of reading it. they get a file of
+ * their own, so the readers' data and its crc32c sidecars stay intact.
+ */
+static const char *writers[] = {
+    "posix_write",
+    "io_uring_write",
+};
+
+/**
+ * named sets of engine specs, selected with -s
+ */
+struct suite {
+    const char *name;
+    const char *description;
+    const char *specs[MAX_ENGINES];
+};
+
+static const struct suite suites[] = {
+    {
+        "attach-wq",
+        "N rings with N sq poll threads vs N rings sharing one (IORING_SETUP_ATTACH_WQ)",
+        {
+            "io_uring_sqpoll -t 1",
+            "io_uring_sqpoll -t 2",
+            "io_uring_sqpoll -t 2 --attach-wq",
+            "io_uring_sqpoll -t 4",
+            "io_uring_sqpoll -t 4 --attach-wq",
+            "io_uring_sqpoll -t 8",
+            "io_uring_sqpoll -t 8 --attach-wq",
+            NULL,
+        },
+    },
+    {
+        "iopoll",
+        "interrupt vs polled completions: IRQ, IOPOLL, SQPOLL and SQPOLL+IOPOLL",
+        {
+            "io_uring_sqpoll --no-sqpoll",
+            "io_uring_sqpoll --no-sqpoll --iopoll",
+            "io_uring_sqpoll",
+            "io_uring_sqpoll --iopoll",
+            NULL,
+        },
+    },
+    {
+        "wal",
+        "pwrite+fdatasync vs ring writes with linked or drained fsync, on file" WAL_SUFFIX,
+        {
+            "posix_write -S 1",
+            "posix_write -S 16",
+            "io_uring_write -S 1",
+            "io_uring_write -S 16 -m link",
+            "io_uring_write -S 16 -m drain",
+            "io_uring_write -S 16 -m drain -F",
+            NULL,
+        },
+    },
+    {
+        "splice",
+        "streaming the file to a pipe and a tcp socket: read+write vs copy, splice, tee and send_zc",
+        {
+            "io_uring_splice -m rw -o pipe",
+            "io_uring_splice -m copy -o pipe",
+            "io_uring_splice -m splice -o pipe",
+            "io_uring_splice -m tee -o pipe",
+            "io_uring_splice -m rw -o tcp",
+            "io_uring_splice -m copy -o tcp",
+            "io_uring_splice -m splice -o tcp",
+            "io_uring_splice -m sendzc -o tcp",
+            NULL,
+        },
+    },
+    {
+        "engines",
+        "the engine library's backends driven in-process: pread, liburing, sqpoll, raw syscalls and raw sqpoll",
+        {
+            "engine_bench -e pread",
+            "engine_bench -e liburing",
+            "engine_bench -e sqpoll",
+            "engine_bench -e raw",
+            "engine_bench -e raw-sqpoll",
+            NULL,
+        },
+    },
+    {
+        "pread-pool",
+        "blocking pread on 1, 8 and 32 threads vs io_uring with 8 and 32 reads in flight",
+        {
+            "posix_read -t 1",
+            "posix_read -t 8",
+            "posix_read -t 32",
+            "liburing_read -q 8",
+            "liburing_read -q 32",
+            "io_uring_sqpoll -q 8",
+            "io_uring_sqpoll -q 32",
+            NULL,
+        },
+    },
+};
+
+const struct suite *find_suite(const char *name) {
+    for (size_t i = 0; i < sizeof(suites) / sizeof(suites[0]); i++) {
+        if (!strcmp(suites[i].name, name)) {
+            return &suites[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * whether the program of spec ("program [args...]") is one of writers[]
+ */
+int is_writer(const char *spec) {
+    size_t len = strcspn(spec, " \t");
+    const char *name = memrchr(spec, '/', len);
+    name = name ? name + 1 : spec;
+    len -= name - spec;
+    for (size_t i = 0; i < sizeof(writers) / sizeof(writers[0]); i++) {
+        if (strlen(writers[i]) == len && !strncmp(writers[i], name, len)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * drop clean page cache, dentries and inodes. needs root.
+ */
+int drop_caches(void) {
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+    int ret = write(fd, "3", 1) == 1 ? 0 : -errno;
+    close(fd);
+    return ret;
+}
+
+/**
+ * parse a csv line written by report_result(REPORT_CSV)
+ */
+int parse_record(char *line, struct run_record *rec) {
+    char *comma = strchr(line, ',');
+    if (!comma) {
+        return -1;
+    }
+    *comma = '\0';
+    snprintf(rec->engine, sizeof(rec->engine), "%.*s", (int)sizeof(rec->engine) - 1, line);
+    unsigned long long elapsed;
+    int n = sscanf(comma + 1, "%zu,%zu,%zu,%llu,%lf,%lf,%lf,%lf,%lf", &rec->block_size, &rec->bytes, &rec->ops,
+                   &elapsed, &rec->mbps, &rec->iops, &rec->p50_us, &rec->p99_us, &rec->p999_us);
+    rec->elapsed_ns = elapsed;
+    return n == 9 ? 0 : -1;
+}
+
+/**
+ * run one engine spec ("program [args...]") on filename and parse its record
+ */
+int run_engine(const char *bindir, const char *spec, const char *filename, struct run_record *rec) {
+    wordexp_t words;
+    if (wordexp(spec, &words, WRDE_NOCMD)) {
+        fprintf(stderr, "cannot parse engine spec: %s\n", spec);
+        return -1;
+    }
+
+    char program[PATH_MAX];
+    if (strchr(words.we_wordv[0], '/')) {
+        snprintf(program, sizeof(program), "%s", words.we_wordv[0]);
+    } else {
+        snprintf(program, sizeof(program), "%s/%s", bindir, words.we_wordv[0]);
+    }
+
+    char **argv = calloc(words.we_wordc + 4, sizeof(char *));
+    argv[0] = program;
+    for (size_t i = 1; i < words.we_wordc; i++) {
+        argv[i] = words.we_wordv[i];
+    }
+    argv[words.we_wordc] = "-f";
+    argv[words.we_wordc + 1] = "csv";
+    argv[words.we_wordc + 2] = (char *)filename;
+
+    int pipefd[2];
+    if (pipe(pipefd)) {
+        perror("pipe: ");
+        free(argv);
+        wordfree(&words);
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[0]);
+        close(pipefd[1]);
+        execv(program, argv);
+        fprintf(stderr, "exec %s: %s\n", program, strerror(errno));
+        _exit(127);
+    }
+    close(pipefd[1]);
+    free(argv);
+    wordfree(&words);
+    if (pid < 0) {
+        perror("fork: ");
+        close(pipefd[0]);
+        return -1;
+    }
+
+    FILE *out = fdopen(pipefd[0], "r");
+    char line[1024];
+    int ret = -1;
+    while (fgets(line, sizeof(line), out)) {
+        if (ret && !parse_record(line, rec)) {
+            ret = 0;
+        }
+    }
+    fclose(out);
+
+    int status;
+    struct rusage ru;
+    wait4(pid, &status, 0, &ru);
+    rec->cpu_s = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "%s: exited abnormally\n", spec);
+        return -1;
+    }
+    return ret;
+}
+
+void print_usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-r runs] [-f text|csv|json] [-e \"engine [args]\"]... [-s suite] [-b sizes] [-n] filename\n",
+            prog);
+    fprintf(stderr, "  -r runs    repetitions per engine (default 3)\n");
+    fprintf(stderr, "  -f format  output format (default text)\n");
+    fprintf(stderr, "  -e engine  reader program and arguments, may repeat\n");
+    fprintf(stderr, "             posix_write and io_uring_write write filename%s, removed at the end\n", WAL_SUFFIX);
+    fprintf(stderr, "  -s suite   add the engines of a predefined comparison:\n");
+    for (size_t i = 0; i < sizeof(suites) / sizeof(suites[0]); i++) {
+        fprintf(stderr, "               %-12s %s\n", suites[i].name, suites[i].description);
+    }
+    fprintf(stderr, "  -b sizes   comma separated block sizes to sweep, e.g. 4k,128k,1m\n");
+    fprintf(stderr, "  -n         do not drop the page cache between runs\n");
+}
+
+/**
+ * expand every engine spec once per block size of the sweep
+ */
+int expand_block_sizes(const char **engines, int nr_engines, char *sizes, char **specs) {
+    size_t block_sizes[MAX_BLOCK_SIZES];
+    int nr_sizes = 0;
+    for (char *tok = strtok(sizes, ","); tok; tok = strtok(NULL, ",")) {
+        if (nr_sizes == MAX_BLOCK_SIZES) {
+            fprintf(stderr, "too many block sizes\n");
+            return -1;
+        }
+        block_sizes[nr_sizes] = parse_size(tok);
+        if (!valid_block_size(block_sizes[nr_sizes])) {
+            fprintf(stderr, "invalid block size: %s\n", tok);
+            return -1;
+        }
+        nr_sizes++;
+    }
+    int n = 0;
+    for (int e = 0; e < nr_engines; e++) {
+        for (int b = 0; b < nr_sizes; b++) {
+            if (asprintf(&specs[n++], "%s -b %zu", engines[e], block_sizes[b]) < 0) {
+                return -1;
+            }
+        }
+    }
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    const char *engines[MAX_ENGINES * MAX_BLOCK_SIZES];
+    char *specs[MAX_ENGINES * MAX_BLOCK_SIZES];
+    char *sizes = NULL;
+    int nr_engines = 0;
+    int runs = 3;
+    int format = REPORT_TEXT;
+    int drop = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:f:e:s:b:n")) != -1) {
+        switch (opt) {
+        case 'b':
+            sizes = optarg;
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'f':
+            format = parse_report_format(optarg);
+            if (format < 0) {
+                fprintf(stderr, "unknown format: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'e':
+            if (nr_engines == MAX_ENGINES) {
+                fprintf(stderr, "too many engines\n");
+                return -1;
+            }
+            engines[nr_engines++] = optarg;
+            break;
+        case 's': {
+            const struct suite *suite = find_suite(optarg);
+            if (!suite) {
+                fprintf(stderr, "unknown suite: %s\n", optarg);
+                return -1;
+            }
+            for (int i = 0; suite->specs[i]; i++) {
+                if (nr_engines == MAX_ENGINES) {
+                    fprintf(stderr, "too many engines\n");
+                    return -1;
+                }
+                engines[nr_engines++] = suite->specs[i];
+            }
+            break;
+        }
+        case 'n':
+            drop = 0;
+            break;
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+    if (optind >= argc || runs < 1) {
+        print_usage(argv[0]);
+        return -1;
+    }
+    const char *filename = argv[optind];
+    char *wal = NULL;
+    if (asprintf(&wal, "%s%s", filename, WAL_SUFFIX) < 0) {
+        return -1;
+    }
+    int wrote = 0;
+    if (!nr_engines) {
+        for (size_t i = 0; i < sizeof(default_engines) / sizeof(default_engines[0]); i++) {
+            engines[nr_engines++] = default_engines[i];
+        }
+    }
+    if (sizes) {
+        nr_engines = expand_block_sizes(engines, nr_engines, sizes, specs);
+        if (nr_engines < 0) {
+            return -1;
+        }
+        for (int e = 0; e < nr_engines; e++) {
+            engines[e] = specs[e];
+        }
+    }
+
+    char self[PATH_MAX];
+    snprintf(self, sizeof(self), "%s", argv[0]);
+    const char *bindir = dirname(self);
+
+    struct utsname uts;
+    uname(&uts);
+
+    if (format == REPORT_CSV) {
+        printf("kernel,spec,run,%s,cpu_s\n", CSV_HEADER);
+    } else if (format == REPORT_JSON) {
+        printf("{\"kernel\":");
+        json_string(stdout, uts.release);
+        printf(",\"file\":");
+        json_string(stdout, filename);
+        printf(",\"runs\":[");
+    } else {
+        printf("kernel %s, file %s, %d runs per engine\n", uts.release, filename, runs);
+    }
+
+    int first = 1;
+    int failed = 0;
+    for (int e = 0; e < nr_engines; e++) {
+        double sum_mbps = 0, min_mbps = 0, max_mbps = 0;
+        int ok = 0;
+        for (int r = 0; r < runs; r++) {
+            if (drop) {
+                int ret = drop_caches();
+                if (ret) {
+                    fprintf(stderr, "drop_caches: %s, continuing with warm cache\n", strerror(-ret));
+                    drop = 0;
+                }
+            }
+            struct run_record rec;
+            memset(&rec, 0, sizeof(rec));
+            int writer = is_writer(engines[e]);
+            wrote |= writer;
+            if (run_engine(bindir, engines[e], writer ? wal : filename, &rec)) {
+                fprintf(stderr, "%s: run %d failed\n", engines[e], r);
+                failed++;
+                continue;
+            }
+            if (!ok || rec.mbps < min_mbps) {
+                min_mbps = rec.mbps;
+            }
+            if (!ok || rec.mbps > max_mbps) {
+                max_mbps = rec.mbps;
+            }
+            sum_mbps += rec.mbps;
+            ok++;
+
+            switch (format) {
+            case REPORT_CSV:
+                printf("%s,\"%s\",%d,%s,%zu,%zu,%zu,%llu,%.2f,%.0f,%.2f,%.2f,%.2f,%.3f\n", uts.release, engines[e], r,
+                       rec.engine, rec.block_size, rec.bytes, rec.ops, (unsigned long long)rec.elapsed_ns, rec.mbps, rec.iops,
+                       rec.p50_us, rec.p99_us, rec.p999_us, rec.cpu_s);
+                break;
+            case REPORT_JSON:
+                printf("%s{\"spec\":", first ? "" : ",");
+                json_string(stdout, engines[e]);
+                printf(",\"run\":%d,\"engine\":", r);
+                json_string(stdout, rec.engine);
+                printf(",\"block_size\":%zu,\"bytes\":%zu,\"ops\":%zu,"
+                       "\"elapsed_ns\":%llu,\"mb_per_s\":%.2f,\"iops\":%.0f,"
+                       "\"p50_us\":%.2f,\"p99_us\":%.2f,\"p999_us\":%.2f,\"cpu_s\":%.3f}",
+                       rec.block_size, rec.bytes, rec.ops,
+                       (unsigned long long)rec.elapsed_ns, rec.mbps, rec.iops, rec.p50_us, rec.p99_us, rec.p999_us,
+                       rec.cpu_s);
+                break;
+            default:
+                printf("%-40s run %d: %10.2f MB/s %10.0f IOPS  p50 %8.2f us  p99 %8.2f us  p99.9 %8.2f us  cpu %6.2f s\n",
+                       engines[e], r, rec.mbps, rec.iops, rec.p50_us, rec.p99_us, rec.p999_us, rec.cpu_s);
+                break;
+            }
+            first = 0;
+            fflush(stdout);
+        }
+        if (format == REPORT_TEXT && ok) {
+            printf("%-40s mean %.2f MB/s (min %.2f, max %.2f)\n", engines[e], sum_mbps / ok, min_mbps, max_mbps);
+        }
+    }
+    if (format == REPORT_JSON) {
+        printf("]}\n");
+    }
+    if (wrote && unlink(wal) && errno != ENOENT) {
+        fprintf(stderr, "%s: %s\n", wal, strerror(errno));
+    }
+    free(wal);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,193 @@
+/**
+ * timing, option parsing and result reporting shared by the reader programs.
+ *
+ * every reader prints one result record at exit. the record is plain text
+ * for humans, or a single csv/json line that the bench driver collects.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "histogram.h"
+
+#define MIN_BLOCK_SIZE 512         // smallest O_DIRECT transfer
+#define MAX_BLOCK_SIZE (64 << 20)  // largest block accepted on the command line
+#define BUF_ALIGN 4096             // O_DIRECT buffer alignment
+
+enum report_format {
+    REPORT_TEXT,
+    REPORT_CSV,
+    REPORT_JSON,
+};
+
+struct bench_result {
+    const char *engine;  // engine name
+    size_t block_size;   // bytes per request
+    size_t bytes;        // bytes read
+    size_t ops;          // completed requests
+    uint64_t elapsed_ns; // wall clock time of the read loop
+    uint64_t p50_ns;     // median request latency
+    uint64_t p99_ns;     // 99th percentile request latency
+    uint64_t p999_ns;    // 99.9th percentile request latency
+};
+
+#define CSV_HEADER "engine,block_size,bytes,ops,elapsed_ns,mb_per_s,iops,p50_us,p99_us,p999_us"
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * parse "text", "csv" or "json". returns -1 on unknown format.
+ */
+static inline int parse_report_format(const char *name) {
+    if (!strcmp(name, "text")) {
+        return REPORT_TEXT;
+    }
+    if (!strcmp(name, "csv")) {
+        return REPORT_CSV;
+    }
+    if (!strcmp(name, "json")) {
+        return REPORT_JSON;
+    }
+    return -1;
+}
+
+/**
+ * parse a byte count with an optional k, m or g suffix (powers of 1024).
+ * returns 0 on malformed input.
+ */
+static inline size_t parse_size(const char *str) {
+    char *end;
+    unsigned long long val = strtoull(str, &end, 0);
+    switch (*end) {
+    case 'g':
+    case 'G':
+        val <<= 10;
+        /* fall through */
+    case 'm':
+    case 'M':
+        val <<= 10;
+        /* fall through */
+    case 'k':
+    case 'K':
+        val <<= 10;
+        end++;
+        break;
+    }
+    if (end == str || *end != '\0') {
+        return 0;
+    }
+    return val;
+}
+
+/**
+ * block sizes are powers of two between MIN_BLOCK_SIZE and MAX_BLOCK_SIZE,
+ * so every block offset stays aligned for O_DIRECT
+ */
+static inline int valid_block_size(size_t block_size) {
+    return block_size >= MIN_BLOCK_SIZE && block_size <= MAX_BLOCK_SIZE && !(block_size & (block_size - 1));
+}
+
+/**
+ * parse a cpu list such as "0,2,4-7" into cpus. returns the number of cpus
+ * or -1 on malformed input.
+ */
+static inline int parse_cpu_list(const char *str, int *cpus, int max) {
+    int n = 0;
+    while (*str) {
+        char *end;
+        long first = strtol(str, &end, 10);
+        long last = first;
+        if (end == str || first < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            str = end + 1;
+            last = strtol(str, &end, 10);
+            if (end == str || last < first) {
+                return -1;
+            }
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (n == max) {
+                return -1;
+            }
+            cpus[n++] = cpu;
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end) {
+            return -1;
+        }
+        str = end;
+    }
+    return n;
+}
+
+/**
+ * fill the percentile fields of result from the latency histogram
+ */
+static inline void bench_fill_latency(struct bench_result *result, const struct histogram *hist) {
+    result->p50_ns = hist_percentile(hist, 50.0);
+    result->p99_ns = hist_percentile(hist, 99.0);
+    result->p999_ns = hist_percentile(hist, 99.9);
+}
+
+/**
+ * write s as a json string, quotes included, escaping quotes, backslashes
+ * and control characters
+ */
+static inline void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static inline void report_result(FILE *out, int format, const struct bench_result *r) {
+    double secs = r->elapsed_ns / 1e9;
+    double mbps = secs > 0 ? r->bytes / (1024.0 * 1024.0) / secs : 0;
+    double iops = secs > 0 ? r->ops / secs : 0;
+
+    switch (format) {
+    case REPORT_CSV:
+        fprintf(out, "%s,%zu,%zu,%zu,%llu,%.2f,%.0f,%.2f,%.2f,%.2f\n", r->engine, r->block_size, r->bytes, r->ops,
+                (unsigned long long)r->elapsed_ns, mbps, iops,
+                r->p50_ns / 1e3, r->p99_ns / 1e3, r->p999_ns / 1e3);
+        break;
+    case REPORT_JSON:
+        fputs("{\"engine\":", out);
+        json_string(out, r->engine);
+        fprintf(out, ",\"block_size\":%zu,\"bytes\":%zu,\"ops\":%zu,\"elapsed_ns\":%llu,"
+                     "\"mb_per_s\":%.2f,\"iops\":%.0f,\"p50_us\":%.2f,\"p99_us\":%.2f,\"p999_us\":%.2f}\n",
+                r->block_size, r->bytes, r->ops, (unsigned long long)r->elapsed_ns, mbps, iops,
+                r->p50_ns / 1e3, r->p99_ns / 1e3, r->p999_ns / 1e3);
+        break;
+    default:
+        fprintf(out, "%s: %zu bytes in %zu requests of %zu bytes, %.3f s\n", r->engine, r->bytes, r->ops,
+                r->block_size, secs);
+        fprintf(out, "  throughput %.2f MB/s, %.0f IOPS\n", mbps, iops);
+        fprintf(out, "  latency p50 %.2f us, p99 %.2f us, p99.9 %.2f us\n",
+                r->p50_ns / 1e3, r->p99_ns / 1e3, r->p999_ns / 1e3);
+        break;
+    }
+}
+
+#endif
@@ -0,0 +1,88 @@
+/**
+ * fixed-size pool of aligned i/o buffers, allocated once and recycled.
+ *
+ * the pool holds one slot per in-flight request, so memory is bounded by
+ * queue depth x block size no matter how large the file is. the arena comes
+ * from explicit huge pages when the system has them reserved, otherwise from
+ * normal pages with transparent huge pages requested.
+ */
+
+#ifndef BUF_POOL_H
+#define BUF_POOL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define HUGE_PAGE_SIZE (2ul << 20)
+
+struct buf_pool {
+    char *arena;       // slot memory
+    size_t arena_size; // mapped length
+    size_t slot_size;  // bytes per slot
+    unsigned nr_slots; // total slots
+    unsigned *free;    // stack of free slot indices
+    unsigned nr_free;  // free slots on the stack
+    int hugetlb;       // arena is backed by explicit huge pages
+};
+
+static inline int buf_pool_init(struct buf_pool *pool, unsigned nr_slots, size_t slot_size) {
+    memset(pool, 0, sizeof(struct buf_pool));
+    pool->slot_size = slot_size;
+    pool->nr_slots = nr_slots;
+    pool->arena_size = (nr_slots * slot_size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+    void *arena = mmap(NULL, pool->arena_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    if (arena != MAP_FAILED) {
+        pool->hugetlb = 1;
+    } else {
+        arena = mmap(NULL, pool->arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (arena == MAP_FAILED) {
+            perror("mmap: ");
+            return -1;
+        }
+        madvise(arena, pool->arena_size, MADV_HUGEPAGE); // best effort
+        memset(arena, 0, pool->arena_size);              // fault in before the timed loop
+    }
+    pool->arena = arena;
+
+    pool->free = malloc(sizeof(unsigned) * nr_slots);
+    if (!pool->free) {
+        munmap(pool->arena, pool->arena_size);
+        return -1;
+    }
+    // pop order hands out slot 0 first
+    for (unsigned i = 0; i < nr_slots; i++) {
+        pool->free[i] = nr_slots - i - 1;
+    }
+    pool->nr_free = nr_slots;
+    return 0;
+}
+
+static inline char *buf_pool_slot(struct buf_pool *pool, unsigned slot) {
+    return pool->arena + (size_t)slot * pool->slot_size;
+}
+
+/**
+ * take a free slot. returns -1 when every slot is in flight.
+ */
+static inline int buf_pool_get(struct buf_pool *pool) {
+    if (!pool->nr_free) {
+        return -1;
+    }
+    return pool->free[--pool->nr_free];
+}
+
+static inline void buf_pool_put(struct buf_pool *pool, unsigned slot) {
+    pool->free[pool->nr_free++] = slot;
+}
+
+static inline void buf_pool_destroy(struct buf_pool *pool) {
+    munmap(pool->arena, pool->arena_size);
+    free(pool->free);
+    memset(pool, 0, sizeof(struct buf_pool));
+}
+
+#endif
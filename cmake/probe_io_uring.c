@@ -0,0 +1,42 @@
+/**
+ * configure time probe: prints the io_uring opcodes the readers use that
+ * the running kernel does not support, or fails when io_uring is disabled
+ */
+
+#include <liburing.h>
+#include <stdio.h>
+
+static const struct {
+    int op;
+    const char *name;
+} ops[] = {
+    {IORING_OP_READ, "read"},
+    {IORING_OP_READ_FIXED, "read_fixed"},
+    {IORING_OP_WRITE, "write"},
+    {IORING_OP_OPENAT, "openat"},
+    {IORING_OP_CLOSE, "close"},
+    {IORING_OP_LINK_TIMEOUT, "link_timeout"},
+    {IORING_OP_PROVIDE_BUFFERS, "provide_buffers"},
+    {IORING_OP_SPLICE, "splice"},
+    {IORING_OP_TEE, "tee"},
+    {IORING_OP_SEND_ZC, "send_zc"},
+};
+
+int main(void) {
+    struct io_uring_probe *probe = io_uring_get_probe();
+    if (!probe) {
+        printf("io_uring_get_probe failed");
+        return 1;
+    }
+    int missing = 0;
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (!io_uring_opcode_supported(probe, ops[i].op)) {
+            printf("%s%s", missing++ ? ", " : "missing opcodes: ", ops[i].name);
+        }
+    }
+    if (!missing) {
+        printf("every opcode supported, last opcode %d", probe->last_op);
+    }
+    io_uring_free_probe(probe);
+    return 0;
+}
@@ -0,0 +1,209 @@
+/**
+ * crc32c (castagnoli) of data blocks and the sidecar files holding them.
+ *
+ * x86-64 cpus with sse4.2 and arm64 cpus with the crc extension compute it
+ * in hardware, 8 bytes per instruction. everything else falls back to a
+ * byte-wise table. the sse4.2 path is picked at run time, so a generic build
+ * still uses it.
+ *
+ * a sidecar "<file>.crc32c" holds a header and one crc per block of the
+ * file, the last one over the partial tail block only.
+ */
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#define CRC32C_POLY 0x82f63b78     // reflected castagnoli polynomial
+#define CRC32C_SUFFIX ".crc32c"     // sidecar file name suffix
+#define CRC32C_MAGIC "CRC32C\n"    // sidecar magic, 8 bytes with the nul
+#define CRC32C_CHUNK (1 << 20)     // bytes per read when building a sidecar
+
+struct crc32c_header {
+    char magic[8];       // CRC32C_MAGIC
+    uint32_t block_size; // bytes per checksummed block
+    uint32_t reserved;
+    uint64_t file_size;  // size of the file when the sidecar was made
+};
+
+static uint32_t crc32c_table[256];
+static int crc32c_hw; // 1 when the hardware path is usable
+
+/**
+ * build the fallback table and probe the cpu. call once before any thread
+ * computes a crc.
+ */
+static inline void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLY : 0);
+        }
+        crc32c_table[i] = crc;
+    }
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    crc32c_hw = __builtin_cpu_supports("sse4.2");
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    crc32c_hw = 1;
+#endif
+}
+
+static inline uint32_t crc32c_sw(uint32_t crc, const unsigned char *p, size_t len) {
+    while (len--) {
+        crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static inline uint32_t crc32c_hw_update(uint32_t crc, const unsigned char *p,
+                                                                         size_t len) {
+    uint64_t c = crc;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    crc = c;
+    for (; len; p++, len--) {
+        crc = _mm_crc32_u8(crc, *p);
+    }
+    return crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static inline uint32_t crc32c_hw_update(uint32_t crc, const unsigned char *p, size_t len) {
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+    }
+    for (; len; p++, len--) {
+        crc = __crc32cb(crc, *p);
+    }
+    return crc;
+}
+#endif
+
+static inline uint32_t crc32c(const void *buf, size_t len) {
+    uint32_t crc = ~0u;
+#if defined(__x86_64__) || (defined(__aarch64__) && defined(__ARM_FEATURE_CRC32))
+    if (crc32c_hw) {
+        return ~crc32c_hw_update(crc, buf, len);
+    }
+#endif
+    return ~crc32c_sw(crc, buf, len);
+}
+
+static inline int crc32c_is_sidecar(const char *path) {
+    size_t len = strlen(path), suffix = strlen(CRC32C_SUFFIX);
+    return len >= suffix && !strcmp(path + len - suffix, CRC32C_SUFFIX);
+}
+
+/**
+ * checksum every block of path with buffered reads and write the sidecar.
+ * returns 0 or a negative errno.
+ */
+static inline int crc32c_make_sidecar(const char *path, size_t block_size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return -errno;
+    }
+    size_t blocks = st.st_size / block_size + (st.st_size % block_size ? 1 : 0);
+    size_t chunk = block_size > CRC32C_CHUNK ? block_size : CRC32C_CHUNK;
+    uint32_t *sums = malloc(blocks * sizeof(uint32_t));
+    char *buf = malloc(chunk);
+    if (!sums || !buf) {
+        free(sums);
+        free(buf);
+        close(fd);
+        return -ENOMEM;
+    }
+
+    int ret = 0;
+    size_t block = 0;
+    for (off_t off = 0; off < st.st_size && !ret;) {
+        ssize_t n = pread(fd, buf, chunk, off);
+        if (n <= 0) {
+            ret = n < 0 ? -errno : -EIO; // the file shrank under us
+            break;
+        }
+        for (ssize_t pos = 0; pos < n; pos += block_size) {
+            sums[block++] = crc32c(buf + pos, (size_t)(n - pos) < block_size ? (size_t)(n - pos) : block_size);
+        }
+        off += n;
+    }
+    close(fd);
+    free(buf);
+
+    char sidecar[PATH_MAX];
+    snprintf(sidecar, sizeof(sidecar), "%s%s", path, CRC32C_SUFFIX);
+    struct crc32c_header header = {.magic = CRC32C_MAGIC, .block_size = block_size, .file_size = st.st_size};
+    FILE *out = ret ? NULL : fopen(sidecar, "w");
+    if (!ret && !out) {
+        ret = -errno;
+    }
+    if (out) {
+        int short_write =
+            fwrite(&header, sizeof(header), 1, out) != 1 || fwrite(sums, sizeof(uint32_t), blocks, out) != blocks;
+        // a short fwrite need not set errno, only trust the one fclose sets
+        errno = 0;
+        if (fclose(out)) {
+            ret = errno ? -errno : -EIO;
+        } else if (short_write) {
+            ret = -EIO;
+        }
+        if (ret) {
+            unlink(sidecar); // a truncated sidecar would fail every later load
+        }
+    }
+    free(sums);
+    return ret;
+}
+
+/**
+ * load the sidecar of path into sums[0, blocks). fails with -ESTALE when it
+ * was made with another block size or for another file size.
+ */
+static inline int crc32c_load_sidecar(const char *path, size_t block_size, size_t file_size, uint32_t *sums,
+                                      size_t blocks) {
+    char sidecar[PATH_MAX];
+    snprintf(sidecar, sizeof(sidecar), "%s%s", path, CRC32C_SUFFIX);
+    FILE *in = fopen(sidecar, "r");
+    if (!in) {
+        return -errno;
+    }
+    struct crc32c_header header;
+    int ret = 0;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, CRC32C_MAGIC, sizeof(header.magic))) {
+        ret = -EINVAL;
+    } else if (header.block_size != block_size || header.file_size != file_size) {
+        ret = -ESTALE;
+    } else if (fread(sums, sizeof(uint32_t), blocks, in) != blocks) {
+        ret = -EINVAL;
+    }
+    fclose(in);
+    return ret;
+}
+
+#endif
@@ -0,0 +1,145 @@
+/**
+ * backend registry and the calls shared by every engine
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+const struct engine_ops *const engine_backends[] = {
+    &engine_pread_ops,
+    &engine_liburing_ops,
+    &engine_sqpoll_ops,
+    &engine_raw_ops,
+    &engine_raw_sqpoll_ops,
+    NULL,
+};
+
+/**
+ * "auto" tries these in order, the first one the kernel accepts wins
+ */
+static const struct engine_ops *const auto_backends[] = {
+    &engine_sqpoll_ops,
+    &engine_liburing_ops,
+    &engine_pread_ops,
+    NULL,
+};
+
+static struct engine *create_auto(const struct engine_params *params, int *err) {
+    for (int i = 0; auto_backends[i]; i++) {
+        struct engine *e = engine_create(auto_backends[i]->name, params, err);
+        if (e) {
+            fprintf(stderr, "engine auto: %s\n", auto_backends[i]->name);
+            return e;
+        }
+        if (auto_backends[i + 1]) {
+            // e.g. io_uring disabled by sysctl or seccomp, or sq affinity refused
+            fprintf(stderr, "engine auto: %s: %s, falling back\n", auto_backends[i]->name, strerror(-*err));
+        }
+    }
+    return NULL;
+}
+
+struct engine *engine_create(const char *name, const struct engine_params *params, int *err) {
+    if (!params->depth) {
+        *err = -EINVAL;
+        return NULL;
+    }
+    if (!strcmp(name, "auto")) {
+        return create_auto(params, err);
+    }
+    const struct engine_ops *ops = NULL;
+    for (int i = 0; engine_backends[i]; i++) {
+        if (!strcmp(engine_backends[i]->name, name)) {
+            ops = engine_backends[i];
+            break;
+        }
+    }
+    if (!ops) {
+        *err = -ENOENT;
+        return NULL;
+    }
+    struct engine *e = calloc(1, sizeof(struct engine));
+    if (!e) {
+        *err = -ENOMEM;
+        return NULL;
+    }
+    e->ops = ops;
+    e->params = *params;
+    *err = ops->init(e);
+    if (*err) {
+        free(e);
+        return NULL;
+    }
+    return e;
+}
+
+int engine_submit(struct engine *e, struct engine_req *req) {
+    if (e->inflight >= e->params.depth) {
+        return -EBUSY;
+    }
+    int ret = e->ops->submit(e, req);
+    if (!ret) {
+        e->inflight++;
+    }
+    return ret;
+}
+
+int engine_poll(struct engine *e, unsigned min) {
+    if (min > e->inflight) {
+        min = e->inflight; // never wait for reads that were not submitted
+    }
+    return e->ops->poll(e, min);
+}
+
+int engine_drain(struct engine *e) {
+    while (e->inflight) {
+        int ret = e->ops->poll(e, 1);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+void engine_destroy(struct engine *e) {
+    e->ops->exit(e);
+    free(e);
+}
+
+int engine_open_file(const char *path, size_t *size, size_t *dio_align) {
+    *dio_align = 1;
+    int fd = open(path, O_RDONLY | O_DIRECT);
+    if (fd < 0 && errno == EINVAL) {
+        fprintf(stderr, "%s: no O_DIRECT support, reading through the page cache\n", path);
+        fd = open(path, O_RDONLY);
+    } else if (fd >= 0) {
+        *dio_align = 4096; // page alignment satisfies every block device
+#ifdef STATX_DIOALIGN
+        struct statx stx;
+        if (!statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) && (stx.stx_mask & STATX_DIOALIGN) &&
+            stx.stx_dio_offset_align) {
+            *dio_align = stx.stx_dio_offset_align;
+        }
+#endif
+    }
+    if (fd < 0) {
+        return -errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        int ret = -errno;
+        close(fd);
+        return ret;
+    }
+    *size = st.st_size;
+    return fd;
+}
@@ -0,0 +1,126 @@
+/**
+ * asynchronous block read engines behind one interface, so readers can A/B
+ * backends inside one process instead of forking one program per engine.
+ *
+ *     struct engine *e = engine_create("sqpoll", &params, &err);
+ *     engine_submit(e, req);  // queue a read, -EBUSY when depth reads are in flight
+ *     engine_poll(e, 1);      // push queued reads, run at least one completion
+ *     engine_drain(e);        // run completions until nothing is in flight
+ *     engine_destroy(e);
+ *
+ * a request's complete() handler runs from engine_poll() or engine_drain(),
+ * never from engine_submit(), whatever the backend.
+ *
+ * backends:
+ *   pread       blocking pread(2), the read happens inside engine_submit()
+ *   liburing    liburing ring, one io_uring_enter per poll
+ *   sqpoll      liburing ring with a kernel submission polling thread
+ *   raw         ring set up and mapped by hand with the io_uring syscalls
+ *               (raw_ring.h), no liburing
+ *   raw-sqpoll  raw ring with a kernel submission polling thread
+ *
+ * engine_create("auto", ...) takes the first of sqpoll, liburing and pread
+ * this kernel lets it create and logs the choice to stderr, e->ops->name
+ * tells which one it is.
+ */
+
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct engine;
+
+/**
+ * one read. the caller owns the memory until complete() ran.
+ */
+struct engine_req {
+    int fd;        // file to read
+    void *buf;     // destination, aligned for O_DIRECT files
+    size_t len;    // bytes to read
+    off_t offset;  // file offset
+    int res;       // bytes read or -errno, valid in complete()
+    void *data;    // owner's context
+    void (*complete)(struct engine_req *req); // completion handler
+};
+
+struct engine_params {
+    unsigned depth;   // reads in flight, also the ring size
+    int sq_cpu;       // sqpoll: cpu of the sq thread, -1 for any
+    unsigned sq_idle; // sqpoll: ms the sq thread spins before sleeping
+};
+
+/**
+ * backend entry points. poll submits whatever submit queued and completes
+ * at least min requests through engine_complete().
+ */
+struct engine_ops {
+    const char *name;
+    int (*init)(struct engine *e);
+    int (*submit)(struct engine *e, struct engine_req *req);
+    int (*poll)(struct engine *e, unsigned min);
+    void (*exit)(struct engine *e);
+};
+
+struct engine {
+    const struct engine_ops *ops;
+    struct engine_params params;
+    unsigned inflight; // submitted reads whose complete() did not run yet
+    void *priv;        // backend state
+};
+
+extern const struct engine_ops engine_pread_ops;
+extern const struct engine_ops engine_liburing_ops;
+extern const struct engine_ops engine_sqpoll_ops;
+extern const struct engine_ops engine_raw_ops;
+extern const struct engine_ops engine_raw_sqpoll_ops;
+
+/**
+ * backends by name, NULL terminated
+ */
+extern const struct engine_ops *const engine_backends[];
+
+/**
+ * create an engine of backend name, or "auto". returns NULL and sets *err
+ * to a negative errno on failure, -ENOENT for an unknown name.
+ */
+struct engine *engine_create(const char *name, const struct engine_params *params, int *err);
+
+/**
+ * queue req. returns 0, -EBUSY when depth reads are in flight, or another
+ * negative errno.
+ */
+int engine_submit(struct engine *e, struct engine_req *req);
+
+/**
+ * submit the queued reads and run at least min completions, 0 only runs
+ * those that are ready. returns the number of completions or -errno.
+ */
+int engine_poll(struct engine *e, unsigned min);
+
+/**
+ * run completions until no read is in flight
+ */
+int engine_drain(struct engine *e);
+
+void engine_destroy(struct engine *e);
+
+/**
+ * open path for reading with O_DIRECT, or through the page cache when the
+ * filesystem refuses O_DIRECT. *size is the file size, *dio_align the offset
+ * and length alignment reads of the file need, 1 when buffered. returns the
+ * fd or -errno.
+ */
+int engine_open_file(const char *path, size_t *size, size_t *dio_align);
+
+/**
+ * for backends: hand a finished read back to its owner
+ */
+static inline void engine_complete(struct engine *e, struct engine_req *req, int res) {
+    e->inflight--;
+    req->res = res;
+    req->complete(req);
+}
+
+#endif
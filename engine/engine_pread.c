@@ -0,0 +1,68 @@
+/**
+ * blocking pread(2) backend. the read runs inside submit, the request waits
+ * on a fifo until the next poll runs its completion.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+struct pread_engine {
+    struct engine_req **done; // finished reads, fifo of depth entries
+    unsigned head;            // next completion to run
+    unsigned nr;              // reads waiting for their completion
+};
+
+static int pread_init(struct engine *e) {
+    struct pread_engine *p = calloc(1, sizeof(struct pread_engine));
+    if (!p) {
+        return -ENOMEM;
+    }
+    p->done = calloc(e->params.depth, sizeof(struct engine_req *));
+    if (!p->done) {
+        free(p);
+        return -ENOMEM;
+    }
+    e->priv = p;
+    return 0;
+}
+
+static int pread_submit(struct engine *e, struct engine_req *req) {
+    struct pread_engine *p = e->priv;
+    ssize_t ret = pread(req->fd, req->buf, req->len, req->offset);
+    req->res = ret < 0 ? -errno : ret;
+    // engine_submit keeps at most depth reads in the fifo
+    p->done[(p->head + p->nr++) % e->params.depth] = req;
+    return 0;
+}
+
+static int pread_poll(struct engine *e, unsigned min) {
+    struct pread_engine *p = e->priv;
+    int nr = 0;
+    // every submitted read is already done, min is always met. reads the
+    // handlers submit wait for the next poll
+    for (unsigned ready = p->nr; ready; ready--) {
+        struct engine_req *req = p->done[p->head];
+        p->head = (p->head + 1) % e->params.depth;
+        p->nr--;
+        engine_complete(e, req, req->res);
+        nr++;
+    }
+    return nr;
+}
+
+static void pread_exit(struct engine *e) {
+    struct pread_engine *p = e->priv;
+    free(p->done);
+    free(p);
+}
+
+const struct engine_ops engine_pread_ops = {
+    .name = "pread",
+    .init = pread_init,
+    .submit = pread_submit,
+    .poll = pread_poll,
+    .exit = pread_exit,
+};
@@ -0,0 +1,116 @@
+/**
+ * raw io_uring backends on raw_ring.h, no liburing. raw enters the kernel
+ * once per poll, raw-sqpoll leaves submission to a kernel thread and only
+ * enters to wake it or to wait for completions.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "raw_ring.h"
+
+#define RAW_REAP_BATCH 256 // completions handled per peek
+
+static int raw_setup(struct engine *e, unsigned flags) {
+    struct raw_ring *ring = malloc(sizeof(struct raw_ring));
+    if (!ring) {
+        return -ENOMEM;
+    }
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = flags;
+    if (flags & IORING_SETUP_SQPOLL) {
+        params.sq_thread_idle = e->params.sq_idle;
+        if (e->params.sq_cpu >= 0) {
+            params.flags |= IORING_SETUP_SQ_AFF;
+            params.sq_thread_cpu = e->params.sq_cpu;
+        }
+    }
+    int ret = raw_ring_init(ring, e->params.depth, &params);
+    if (ret) {
+        free(ring);
+        return ret;
+    }
+    e->priv = ring;
+    return 0;
+}
+
+static int raw_init(struct engine *e) {
+    return raw_setup(e, 0);
+}
+
+static int raw_sqpoll_init(struct engine *e) {
+    return raw_setup(e, IORING_SETUP_SQPOLL);
+}
+
+static int raw_submit(struct engine *e, struct engine_req *req) {
+    struct raw_ring *ring = e->priv;
+    struct io_uring_sqe *sqe = raw_ring_get_sqe(ring);
+    if (!sqe) {
+        // the sq holds at least depth entries, so only an sq thread that is
+        // behind leaves it full
+        int ret = raw_ring_submit(ring, 0);
+        if (ret < 0) {
+            return ret;
+        }
+        sqe = raw_ring_get_sqe(ring);
+        if (!sqe) {
+            return -EBUSY;
+        }
+    }
+    raw_ring_prep_read(sqe, req->fd, req->buf, req->len, req->offset, (uintptr_t)req);
+    if (ring->flags & IORING_SETUP_SQPOLL) {
+        // a tail store, and a syscall only when the sq thread sleeps
+        int ret = raw_ring_submit(ring, 0);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+static int raw_poll(struct engine *e, unsigned min) {
+    struct raw_ring *ring = e->priv;
+    struct io_uring_cqe *cqes[RAW_REAP_BATCH];
+    // every sqe queued since the last poll goes out with one tail store
+    int ret = raw_ring_submit(ring, min);
+    if (ret < 0) {
+        return ret;
+    }
+    int total = 0;
+    for (;;) {
+        unsigned nr = raw_ring_peek_batch(ring, cqes, RAW_REAP_BATCH);
+        if (!nr) {
+            break;
+        }
+        for (unsigned i = 0; i < nr; i++) {
+            engine_complete(e, (struct engine_req *)(uintptr_t)cqes[i]->user_data, cqes[i]->res);
+        }
+        raw_ring_cq_advance(ring, nr);
+        total += nr;
+    }
+    return total;
+}
+
+static void raw_exit(struct engine *e) {
+    raw_ring_exit(e->priv);
+    free(e->priv);
+}
+
+const struct engine_ops engine_raw_ops = {
+    .name = "raw",
+    .init = raw_init,
+    .submit = raw_submit,
+    .poll = raw_poll,
+    .exit = raw_exit,
+};
+
+const struct engine_ops engine_raw_sqpoll_ops = {
+    .name = "raw-sqpoll",
+    .init = raw_sqpoll_init,
+    .submit = raw_submit,
+    .poll = raw_poll,
+    .exit = raw_exit,
+};
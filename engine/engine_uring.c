@@ -0,0 +1,107 @@
+/**
+ * liburing backends. liburing submits with io_uring_enter on every poll,
+ * sqpoll leaves submission to a kernel thread and only enters the kernel to
+ * wake it or to wait for completions.
+ */
+
+#include <errno.h>
+#include <liburing.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+
+#define URING_REAP_BATCH 256 // completions handled per peek
+
+static int uring_setup(struct engine *e, unsigned flags) {
+    struct io_uring *ring = calloc(1, sizeof(struct io_uring));
+    if (!ring) {
+        return -ENOMEM;
+    }
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = flags;
+    if (flags & IORING_SETUP_SQPOLL) {
+        params.sq_thread_idle = e->params.sq_idle;
+        if (e->params.sq_cpu >= 0) {
+            params.flags |= IORING_SETUP_SQ_AFF;
+            params.sq_thread_cpu = e->params.sq_cpu;
+        }
+    }
+    int ret = io_uring_queue_init_params(e->params.depth, ring, &params);
+    if (ret) {
+        free(ring);
+        return ret;
+    }
+    e->priv = ring;
+    return 0;
+}
+
+static int liburing_init(struct engine *e) {
+    return uring_setup(e, 0);
+}
+
+static int sqpoll_init(struct engine *e) {
+    return uring_setup(e, IORING_SETUP_SQPOLL);
+}
+
+static int uring_submit(struct engine *e, struct engine_req *req) {
+    struct io_uring *ring = e->priv;
+    // the sq holds depth entries and engine_submit caps the reads in flight
+    // at depth, but with sqpoll the kernel may not have consumed them yet
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+    while (!sqe) {
+        io_uring_submit(ring);
+        io_uring_sqring_wait(ring);
+        sqe = io_uring_get_sqe(ring);
+    }
+    io_uring_prep_read(sqe, req->fd, req->buf, req->len, req->offset);
+    io_uring_sqe_set_data(sqe, req);
+    if (ring->flags & IORING_SETUP_SQPOLL) {
+        io_uring_submit(ring); // a tail update, and a syscall only when the sq thread sleeps
+    }
+    return 0;
+}
+
+static int uring_poll(struct engine *e, unsigned min) {
+    struct io_uring *ring = e->priv;
+    struct io_uring_cqe *cqes[URING_REAP_BATCH];
+    int ret = io_uring_submit_and_wait(ring, min);
+    if (ret < 0) {
+        return ret;
+    }
+    int total = 0;
+    for (;;) {
+        unsigned nr = io_uring_peek_batch_cqe(ring, cqes, URING_REAP_BATCH);
+        if (!nr) {
+            break;
+        }
+        for (unsigned i = 0; i < nr; i++) {
+            engine_complete(e, io_uring_cqe_get_data(cqes[i]), cqes[i]->res);
+        }
+        io_uring_cq_advance(ring, nr);
+        total += nr;
+    }
+    return total;
+}
+
+static void uring_exit(struct engine *e) {
+    io_uring_queue_exit(e->priv);
+    free(e->priv);
+}
+
+const struct engine_ops engine_liburing_ops = {
+    .name = "liburing",
+    .init = liburing_init,
+    .submit = uring_submit,
+    .poll = uring_poll,
+    .exit = uring_exit,
+};
+
+const struct engine_ops engine_sqpoll_ops = {
+    .name = "sqpoll",
+    .init = sqpoll_init,
+    .submit = uring_submit,
+    .poll = uring_poll,
+    .exit = uring_exit,
+};
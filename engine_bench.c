@@ -0,0 +1,235 @@
+/**
+ * reads a file once per engine backend inside one process, so backends are
+ * compared on the same file, buffers and access pattern without forking a
+ * program per engine.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "buf_pool.h"
+#include "engine/engine.h"
+#include "pattern.h"
+
+#define BUF_SIZE 4096   // default block size
+#define ENTRIES 32      // default queue depth
+#define SQ_IDLE_MS 2000 // sqpoll: sq thread idle time before it sleeps
+#define MAX_RUNS 16     // engines per invocation
+#define USAGE                                                                                   \
+    "usage %s [-e engine[,engine...]] [-q depth] [-b block_size] [-p pattern] [-S sq_cpu] " \
+    "[-f text|csv|json] filename\n"
+
+struct bench_req {
+    struct engine_req req;
+    size_t expected;         // bytes the block holds, less than block_size for the tail
+    uint64_t submit_ns;      // submission timestamp
+    struct bench_req *next;  // free list link
+};
+
+static unsigned depth = ENTRIES;
+static size_t block_size = BUF_SIZE;
+static int sq_cpu = -1;
+static struct pattern pattern;
+
+static struct histogram latency;
+static struct bench_result result;
+static struct bench_req *free_reqs; // requests not in flight
+static size_t failed;               // reads that failed or came back short
+
+static void read_done(struct engine_req *req) {
+    struct bench_req *r = req->data;
+    hist_record(&latency, hist_now_ns() - r->submit_ns);
+    if (req->res != (int)r->expected) {
+        if (failed++ == 0) {
+            fprintf(stderr, "read at %lld: %s\n", (long long)req->offset,
+                    req->res < 0 ? strerror(-req->res) : "short read");
+        }
+    } else {
+        result.bytes += req->res;
+    }
+    result.ops++;
+    r->next = free_reqs;
+    free_reqs = r;
+}
+
+/**
+ * read every block of fd once through backend name
+ */
+static int run_engine(const char *name, int fd, size_t file_size, struct bench_req *reqs) {
+    struct engine_params params = {
+        .depth = depth,
+        .sq_cpu = sq_cpu,
+        .sq_idle = SQ_IDLE_MS,
+    };
+    int ret;
+    struct engine *e = engine_create(name, &params, &ret);
+    if (!e) {
+        fprintf(stderr, "%s: %s\n", name, ret == -ENOENT ? "unknown engine" : strerror(-ret));
+        return ret;
+    }
+
+    size_t blocks = file_size / block_size + (file_size % block_size ? 1 : 0);
+    free_reqs = NULL;
+    for (unsigned i = 0; i < depth; i++) {
+        reqs[i].next = free_reqs;
+        free_reqs = &reqs[i];
+    }
+    memset(&result, 0, sizeof(result));
+    result.engine = e->ops->name; // the backend "auto" picked
+    result.block_size = block_size;
+    hist_init(&latency);
+    pattern_init(&pattern, blocks, 0);
+
+    uint64_t start = now_ns();
+    size_t next = 0;
+    while (next < blocks || e->inflight) {
+        while (next < blocks && free_reqs) {
+            struct bench_req *r = free_reqs;
+            off_t offset = (off_t)pattern_block(&pattern, next) * block_size;
+            r->req.offset = offset;
+            r->req.len = block_size; // O_DIRECT reads stay whole blocks, the tail read comes back short
+            r->expected = file_size - offset < block_size ? file_size - offset : block_size;
+            r->submit_ns = hist_now_ns();
+            ret = engine_submit(e, &r->req);
+            if (ret == -EBUSY) {
+                break;
+            }
+            if (ret) {
+                fprintf(stderr, "%s: submit: %s\n", name, strerror(-ret));
+                goto out;
+            }
+            free_reqs = r->next;
+            next++;
+        }
+        ret = engine_poll(e, 1);
+        if (ret < 0) {
+            fprintf(stderr, "%s: poll: %s\n", name, strerror(-ret));
+            goto out;
+        }
+    }
+    ret = 0;
+out:
+    result.elapsed_ns = now_ns() - start;
+    if (ret) {
+        engine_drain(e);
+    }
+    engine_destroy(e);
+    bench_fill_latency(&result, &latency);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    int format = REPORT_TEXT;
+    char *engines = NULL;
+    parse_pattern("zigzag", &pattern);
+    int opt;
+    while ((opt = getopt(argc, argv, "e:q:b:p:S:f:")) != -1) {
+        switch (opt) {
+        case 'e':
+            engines = optarg;
+            break;
+        case 'q':
+            depth = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            block_size = parse_size(optarg);
+            if (!valid_block_size(block_size)) {
+                fprintf(stderr, "block size must be a power of two between %d and %d\n", MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+                return -1;
+            }
+            break;
+        case 'p':
+            if (parse_pattern(optarg, &pattern)) {
+                fprintf(stderr, "unknown pattern: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'S':
+            sq_cpu = strtol(optarg, NULL, 0);
+            break;
+        case 'f':
+            format = parse_report_format(optarg);
+            if (format < 0) {
+                fprintf(stderr, "unknown format: %s\n", optarg);
+                return -1;
+            }
+            break;
+        default:
+            printf(USAGE, argv[0]);
+            return -1;
+        }
+    }
+    if (optind >= argc || !depth) {
+        printf(USAGE, argv[0]);
+        return -1;
+    }
+
+    // every backend by default
+    const char *names[MAX_RUNS];
+    int nr_names = 0;
+    if (engines) {
+        for (char *name = strtok(engines, ","); name; name = strtok(NULL, ",")) {
+            if (nr_names == MAX_RUNS) {
+                fprintf(stderr, "at most %d engines per run\n", MAX_RUNS);
+                return -1;
+            }
+            names[nr_names++] = name;
+        }
+    } else {
+        for (int i = 0; engine_backends[i] && nr_names < MAX_RUNS; i++) {
+            names[nr_names++] = engine_backends[i]->name;
+        }
+    }
+
+    size_t file_size, dio_align;
+    int fd = engine_open_file(argv[optind], &file_size, &dio_align);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(-fd));
+        return -1;
+    }
+    if (block_size % dio_align) {
+        fprintf(stderr, "block size must be a multiple of %zu for this file\n", dio_align);
+        close(fd);
+        return -1;
+    }
+    struct buf_pool pool;
+    if (buf_pool_init(&pool, depth, block_size)) {
+        close(fd);
+        return -1;
+    }
+    struct bench_req *reqs = calloc(depth, sizeof(struct bench_req));
+    for (unsigned i = 0; i < depth; i++) {
+        reqs[i].req.fd = fd;
+        reqs[i].req.buf = buf_pool_slot(&pool, i);
+        reqs[i].req.data = &reqs[i];
+        reqs[i].req.complete = read_done;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < nr_names; i++) {
+        failed = 0;
+        if (run_engine(names[i], fd, file_size, reqs)) {
+            ret = -1;
+            continue;
+        }
+        report_result(stdout, format, &result);
+        if (format == REPORT_TEXT) {
+            hist_print(stdout, &latency);
+        }
+        if (failed) {
+            fprintf(stderr, "%s: %zu failed reads\n", names[i], failed);
+            ret = -1;
+        }
+    }
+
+    free(reqs);
+    buf_pool_destroy(&pool);
+    close(fd);
+    return ret;
+}
@@ -0,0 +1,131 @@
+/**
+ * log-linear latency histogram, in the spirit of HdrHistogram.
+ *
+ * values below 2 * HIST_SUB_COUNT ns get a bucket each. above that, every
+ * power of two is split into HIST_SUB_COUNT linear buckets, so a recorded
+ * value is off by at most 1 / HIST_SUB_COUNT (about 3%). recording is a
+ * few shifts, adds and compares, cheap enough to leave on for every request.
+ * a histogram has one writer: threads record into their own and the owner
+ * merges them with hist_merge() once they stopped.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB_COUNT)
+
+struct histogram {
+    uint64_t counts[HIST_BUCKETS]; // samples per bucket
+    uint64_t count;                // total samples
+    uint64_t sum;                  // sum of all samples, for the mean
+    uint64_t min;                  // smallest sample
+    uint64_t max;                  // largest sample
+};
+
+/**
+ * request timestamps. CLOCK_MONOTONIC_RAW is served by the vdso and is not
+ * slewed by ntp, so intervals are not stretched or squeezed mid-run.
+ */
+static inline uint64_t hist_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void hist_init(struct histogram *h) {
+    memset(h, 0, sizeof(struct histogram));
+    h->min = UINT64_MAX;
+}
+
+static inline unsigned hist_index(uint64_t ns) {
+    if (ns < 2 * HIST_SUB_COUNT) {
+        return ns;
+    }
+    unsigned shift = 63 - __builtin_clzll(ns) - HIST_SUB_BITS; // keep the top HIST_SUB_BITS + 1 bits
+    return (shift + 1) * HIST_SUB_COUNT + (ns >> shift) - HIST_SUB_COUNT;
+}
+
+/**
+ * largest value that falls into bucket index
+ */
+static inline uint64_t hist_value(unsigned index) {
+    if (index < 2 * HIST_SUB_COUNT) {
+        return index;
+    }
+    unsigned shift = index / HIST_SUB_COUNT - 1;
+    uint64_t sub = HIST_SUB_COUNT + index % HIST_SUB_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+static inline void hist_record(struct histogram *h, uint64_t ns) {
+    h->counts[hist_index(ns)]++;
+    h->count++;
+    h->sum += ns;
+    if (ns < h->min) {
+        h->min = ns;
+    }
+    if (ns > h->max) {
+        h->max = ns;
+    }
+}
+
+/**
+ * add the samples of src to dst. src must be quiescent.
+ */
+static inline void hist_merge(struct histogram *dst, const struct histogram *src) {
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+/**
+ * nearest-rank percentile, p in [0, 100]. reports the top of the bucket,
+ * clamped to the largest sample, so it never understates the latency.
+ */
+static inline uint64_t hist_percentile(const struct histogram *h, double p) {
+    if (!h->count) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p / 100.0 * h->count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint64_t value = hist_value(i);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
+
+/**
+ * one line with the tail percentiles, for the text report
+ */
+static inline void hist_print(FILE *out, const struct histogram *h) {
+    if (!h->count) {
+        return;
+    }
+    fprintf(out, "  latency min %.2f us, mean %.2f us, p90 %.2f us, p99.99 %.2f us, max %.2f us\n", h->min / 1e3,
+            (double)h->sum / h->count / 1e3, hist_percentile(h, 90.0) / 1e3, hist_percentile(h, 99.99) / 1e3,
+            h->max / 1e3);
+}
+
+#endif
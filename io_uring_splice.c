@@ -0,0 +1,599 @@
+/**
+ * stream a file to stdout, a pipe or a local socket using liburing, without
+ * copying the data through userspace where the kernel allows it.
+ *
+ *   splice  file -> pipe -> output with linked IORING_OP_SPLICE, or one
+ *           splice straight into the output when it already is a pipe
+ *   tee     file -> pipe, IORING_OP_TEE into the output pipe, and the same
+ *           bytes spliced on to a mirror file
+ *   sendzc  IORING_OP_READ_FIXED into a registered buffer, linked
+ *           IORING_OP_SEND_ZC to a tcp socket
+ *   copy    IORING_OP_READ into a buffer, linked IORING_OP_WRITE
+ *   rw      read(2) + write(2) loop, the baseline
+ *
+ * every round queues one chain of depth sqes. the kernel runs it in order, so
+ * the stream stays ordered without a round trip per chunk. a short transfer
+ * breaks the chain, the next round restarts from where the data really is.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <liburing.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "buf_pool.h"
+
+#define CHUNK_SIZE (64 << 10) // default bytes per chunk, the default pipe size
+#define ENTRIES 16            // default submission queue depth
+#define REAP_BATCH 256        // completions handled per peek
+#define DRAIN_SIZE (1 << 20)  // bytes per read of the consumer thread
+#define USAGE                                                                                               \
+    "usage: %s [-m splice|tee|sendzc|copy|rw] [-o stdout|pipe|unix|tcp] [-b chunk] [-q depth] [-T mirror] " \
+    "[-f text|csv|json] filename\n"
+
+enum stream_mode {
+    MODE_SPLICE,
+    MODE_TEE,
+    MODE_SENDZC,
+    MODE_COPY,
+    MODE_RW,
+};
+
+enum output_kind {
+    OUT_STDOUT, // whatever stdout is
+    OUT_PIPE,   // a pipe drained by a consumer thread
+    OUT_UNIX,   // an AF_UNIX stream socketpair drained by a consumer thread
+    OUT_TCP,    // a loopback tcp connection drained by a consumer thread
+};
+
+/**
+ * one queued sqe of a round. the sqe user_data points here.
+ */
+struct stream_op {
+    size_t len;         // requested bytes
+    char *buf;          // user buffer of read/write/send
+    uint64_t submit_ns; // submission timestamp
+    void (*complete)(struct stream_op *op, int res, unsigned flags); // completion handler
+};
+
+static struct histogram latency; // per chunk, from submission to delivery
+static struct bench_result result = {.engine = "io_uring_splice"};
+
+static int mode = MODE_SPLICE;
+static int output = OUT_STDOUT;
+static size_t chunk_size = CHUNK_SIZE;
+static unsigned depth = ENTRIES;
+static const char *mirror_path = "/dev/null";
+
+static int file_fd, out_fd, mirror_fd;
+static int pipe_fds[2] = {-1, -1}; // staging pipe of splice and tee
+static int out_is_pipe;            // splice can target the output directly
+static size_t file_size;
+
+static size_t file_off;   // next file byte to move into the pipe or a buffer
+static size_t pipe_bytes; // bytes sitting in the staging pipe
+static size_t teed;       // bytes at the head of the pipe already teed to the output
+static size_t delivered;  // bytes that reached the output
+static unsigned pending;  // sqes of the round not yet completed
+static unsigned notifs;   // send_zc buffers the kernel still holds
+static int failed;        // a request failed with an error other than a broken link
+
+static struct buf_pool pool; // chunk buffers of copy and sendzc
+
+static void op_error(const char *what, int res) {
+    if (res != -ECANCELED) {
+        fprintf(stderr, "%s: %s\n", what, strerror(-res));
+        failed = 1;
+    }
+}
+
+static void delivered_bytes(struct stream_op *op, int res) {
+    hist_record(&latency, hist_now_ns() - op->submit_ns);
+    delivered += res;
+    result.bytes += res;
+    result.ops++;
+}
+
+/**
+ * file -> staging pipe
+ */
+void fill_done(struct stream_op *op, int res, unsigned flags) {
+    pending--;
+    if (res < 0) {
+        op_error("splice from file", res);
+        return;
+    }
+    file_off += res;
+    pipe_bytes += res;
+}
+
+/**
+ * staging pipe -> output, or file -> output pipe when splicing directly
+ */
+void drain_done(struct stream_op *op, int res, unsigned flags) {
+    pending--;
+    if (res < 0) {
+        op_error("splice to output", res);
+        return;
+    }
+    if (out_is_pipe && mode == MODE_SPLICE) {
+        file_off += res;
+    } else {
+        pipe_bytes -= res;
+    }
+    delivered_bytes(op, res);
+}
+
+/**
+ * staging pipe duplicated into the output pipe, the pipe keeps its data
+ */
+void tee_done(struct stream_op *op, int res, unsigned flags) {
+    pending--;
+    if (res < 0) {
+        op_error("tee", res);
+        return;
+    }
+    teed += res;
+    delivered_bytes(op, res);
+}
+
+/**
+ * teed bytes consumed from the staging pipe into the mirror
+ */
+void mirror_done(struct stream_op *op, int res, unsigned flags) {
+    pending--;
+    if (res < 0) {
+        op_error("splice to mirror", res);
+        return;
+    }
+    pipe_bytes -= res;
+    teed -= res;
+}
+
+void read_done(struct stream_op *op, int res, unsigned flags) {
+    pending--;
+    if (res < 0) {
+        op_error("read", res);
+    }
+}
+
+/**
+ * write or send_zc of a chunk. send_zc posts a second cqe flagged
+ * IORING_CQE_F_NOTIF once the kernel no longer references the buffer.
+ */
+void write_done(struct stream_op *op, int res, unsigned flags) {
+    if (flags & IORING_CQE_F_NOTIF) {
+        notifs--;
+        return;
+    }
+    if (flags & IORING_CQE_F_MORE) {
+        notifs++;
+    }
+    pending--;
+    if (res < 0) {
+        op_error(mode == MODE_SENDZC ? "send_zc" : "write", res);
+        return;
+    }
+    file_off += res; // the next round rereads whatever was not delivered
+    delivered_bytes(op, res);
+}
+
+/**
+ * tag a prepared sqe with its op and link it to the next one
+ */
+static void queue_op(struct io_uring_sqe *sqe, struct stream_op *op, size_t len,
+                     void (*complete)(struct stream_op *, int, unsigned)) {
+    op->len = len;
+    op->complete = complete;
+    op->submit_ns = hist_now_ns();
+    io_uring_sqe_set_data(sqe, op);
+    io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+    pending++;
+}
+
+/**
+ * queue one chain: first whatever the previous round left in the pipe, then
+ * as many new chunks as fit. returns the number of sqes queued.
+ */
+unsigned queue_round(struct io_uring *ring, struct stream_op *ops) {
+    unsigned nr = 0;
+    struct io_uring_sqe *sqe = NULL;
+    size_t off = file_off;
+
+    if (mode == MODE_TEE) {
+        if (teed) {
+            sqe = io_uring_get_sqe(ring);
+            io_uring_prep_splice(sqe, pipe_fds[0], -1, mirror_fd, -1, teed, SPLICE_F_MOVE);
+            queue_op(sqe, &ops[nr++], teed, mirror_done);
+        }
+        if (pipe_bytes > teed) {
+            size_t len = pipe_bytes - teed;
+            sqe = io_uring_get_sqe(ring);
+            io_uring_prep_tee(sqe, pipe_fds[0], out_fd, len, 0);
+            queue_op(sqe, &ops[nr++], len, tee_done);
+            sqe = io_uring_get_sqe(ring);
+            io_uring_prep_splice(sqe, pipe_fds[0], -1, mirror_fd, -1, len, SPLICE_F_MOVE);
+            queue_op(sqe, &ops[nr++], len, mirror_done);
+        }
+    } else if (mode == MODE_SPLICE && pipe_bytes) {
+        sqe = io_uring_get_sqe(ring);
+        io_uring_prep_splice(sqe, pipe_fds[0], -1, out_fd, -1, pipe_bytes, SPLICE_F_MOVE);
+        queue_op(sqe, &ops[nr++], pipe_bytes, drain_done);
+    }
+
+    unsigned per_chunk = mode == MODE_TEE ? 3 : (mode == MODE_SPLICE && out_is_pipe) ? 1 : 2;
+    for (unsigned buf = 0; off < file_size && nr + per_chunk <= depth; buf++) {
+        size_t len = file_size - off < chunk_size ? file_size - off : chunk_size;
+        switch (mode) {
+        case MODE_SPLICE:
+            if (out_is_pipe) {
+                sqe = io_uring_get_sqe(ring);
+                io_uring_prep_splice(sqe, file_fd, off, out_fd, -1, len, SPLICE_F_MOVE);
+                queue_op(sqe, &ops[nr++], len, drain_done);
+                break;
+            }
+            sqe = io_uring_get_sqe(ring);
+            io_uring_prep_splice(sqe, file_fd, off, pipe_fds[1], -1, len, SPLICE_F_MOVE);
+            queue_op(sqe, &ops[nr++], len, fill_done);
+            sqe = io_uring_get_sqe(ring);
+            io_uring_prep_splice(sqe, pipe_fds[0], -1, out_fd, -1, len, SPLICE_F_MOVE);
+            queue_op(sqe, &ops[nr++], len, drain_done);
+            break;
+        case MODE_TEE:
+            sqe = io_uring_get_sqe(ring);
+            io_uring_prep_splice(sqe, file_fd, off, pipe_fds[1], -1, len, SPLICE_F_MOVE);
+            queue_op(sqe, &ops[nr++], len, fill_done);
+            sqe = io_uring_get_sqe(ring);
+            io_uring_prep_tee(sqe, pipe_fds[0], out_fd, len, 0);
+            queue_op(sqe, &ops[nr++], len, tee_done);
+            sqe = io_uring_get_sqe(ring);
+            io_uring_prep_splice(sqe, pipe_fds[0], -1, mirror_fd, -1, len, SPLICE_F_MOVE);
+            queue_op(sqe, &ops[nr++], len, mirror_done);
+            break;
+        case MODE_SENDZC: {
+            char *data = buf_pool_slot(&pool, buf);
+            sqe = io_uring_get_sqe(ring);
+            io_uring_prep_read_fixed(sqe, file_fd, data, len, off, 0);
+            queue_op(sqe, &ops[nr++], len, read_done);
+            sqe = io_uring_get_sqe(ring);
+            // MSG_WAITALL makes the kernel retry partial sends itself
+            io_uring_prep_send_zc(sqe, out_fd, data, len, MSG_WAITALL, IORING_RECVSEND_FIXED_BUF);
+            sqe->buf_index = 0;
+            queue_op(sqe, &ops[nr++], len, write_done);
+            break;
+        }
+        case MODE_COPY: {
+            char *data = buf_pool_slot(&pool, buf);
+            sqe = io_uring_get_sqe(ring);
+            io_uring_prep_read(sqe, file_fd, data, len, off);
+            queue_op(sqe, &ops[nr++], len, read_done);
+            sqe = io_uring_get_sqe(ring);
+            io_uring_prep_write(sqe, out_fd, data, len, -1);
+            queue_op(sqe, &ops[nr++], len, write_done);
+            break;
+        }
+        }
+        off += len;
+    }
+    if (sqe) {
+        io_uring_sqe_set_flags(sqe, 0); // end of the chain
+    }
+    return nr;
+}
+
+void reap(struct io_uring *ring) {
+    struct io_uring_cqe *cqes[REAP_BATCH];
+    while (pending || notifs) {
+        if (!io_uring_cq_ready(ring)) {
+            int ret = io_uring_wait_cqe(ring, &cqes[0]);
+            if (ret < 0) {
+                fprintf(stderr, "io_uring_wait_cqe: %s\n", strerror(-ret));
+                failed = 1;
+                return;
+            }
+        }
+        unsigned nr = io_uring_peek_batch_cqe(ring, cqes, REAP_BATCH);
+        for (unsigned i = 0; i < nr; i++) {
+            struct stream_op *op = io_uring_cqe_get_data(cqes[i]);
+            op->complete(op, cqes[i]->res, cqes[i]->flags);
+        }
+        io_uring_cq_advance(ring, nr);
+    }
+}
+
+int stream_ring(void) {
+    struct io_uring ring;
+    int ret = io_uring_queue_init(depth, &ring, 0);
+    if (ret) {
+        fprintf(stderr, "Unable to setup io_uring: %s\n", strerror(-ret));
+        return ret;
+    }
+    if (mode == MODE_SENDZC || mode == MODE_COPY) {
+        // one buffer per chunk a round can hold
+        if (buf_pool_init(&pool, depth / 2, chunk_size)) {
+            return -1;
+        }
+    }
+    if (mode == MODE_SENDZC) {
+        struct iovec iov = {.iov_base = pool.arena, .iov_len = pool.arena_size};
+        ret = io_uring_register_buffers(&ring, &iov, 1);
+        if (ret) {
+            fprintf(stderr, "io_uring_register_buffers: %s\n", strerror(-ret));
+            return ret;
+        }
+    }
+    struct stream_op *ops = calloc(depth, sizeof(struct stream_op));
+
+    uint64_t start = now_ns();
+    while (!failed && (file_off < file_size || pipe_bytes)) {
+        unsigned nr = queue_round(&ring, ops);
+        if (!nr) {
+            break;
+        }
+        io_uring_submit(&ring);
+        reap(&ring);
+    }
+    result.elapsed_ns = now_ns() - start;
+
+    free(ops);
+    if (mode == MODE_SENDZC || mode == MODE_COPY) {
+        buf_pool_destroy(&pool);
+    }
+    io_uring_queue_exit(&ring);
+    return failed ? -1 : 0;
+}
+
+int stream_rw(void) {
+    char *buf = malloc(chunk_size);
+    if (!buf) {
+        return -1;
+    }
+    uint64_t start = now_ns();
+    while (file_off < file_size) {
+        uint64_t submit = hist_now_ns();
+        ssize_t n = read(file_fd, buf, chunk_size);
+        if (n <= 0) {
+            if (n < 0) {
+                perror("read: ");
+            }
+            break;
+        }
+        for (ssize_t done = 0; done < n;) {
+            ssize_t ret = write(out_fd, buf + done, n - done);
+            if (ret < 0) {
+                perror("write: ");
+                free(buf);
+                return -1;
+            }
+            done += ret;
+        }
+        file_off += n;
+        hist_record(&latency, hist_now_ns() - submit);
+        delivered += n;
+        result.bytes += n;
+        result.ops++;
+    }
+    result.elapsed_ns = now_ns() - start;
+    free(buf);
+    return 0;
+}
+
+/**
+ * consumer on the far end of a pipe or socket output, discards everything
+ */
+void *drain_output(void *arg) {
+    int fd = *(int *)arg;
+    if (output == OUT_PIPE) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        while (splice(fd, NULL, null_fd, NULL, DRAIN_SIZE, SPLICE_F_MOVE) > 0) {
+        }
+        close(null_fd);
+    } else {
+        char *buf = malloc(DRAIN_SIZE);
+        while (recv(fd, buf, DRAIN_SIZE, 0) > 0) {
+        }
+        free(buf);
+    }
+    close(fd);
+    return NULL;
+}
+
+/**
+ * create the output and, unless it is stdout, the consumer thread draining it
+ */
+int open_output(pthread_t *consumer, int *far_end) {
+    int fds[2];
+    switch (output) {
+    case OUT_STDOUT:
+        out_fd = STDOUT_FILENO;
+        return 0;
+    case OUT_PIPE:
+        if (pipe(fds)) {
+            perror("pipe: ");
+            return -1;
+        }
+        fcntl(fds[1], F_SETPIPE_SZ, chunk_size);
+        out_fd = fds[1];
+        *far_end = fds[0];
+        break;
+    case OUT_UNIX:
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+            perror("socketpair: ");
+            return -1;
+        }
+        out_fd = fds[0];
+        *far_end = fds[1];
+        break;
+    case OUT_TCP: {
+        struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+        socklen_t len = sizeof(addr);
+        int listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (listener < 0 || bind(listener, (struct sockaddr *)&addr, len) || listen(listener, 1) ||
+            getsockname(listener, (struct sockaddr *)&addr, &len)) {
+            perror("listen: ");
+            return -1;
+        }
+        out_fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (out_fd < 0 || connect(out_fd, (struct sockaddr *)&addr, len)) {
+            perror("connect: ");
+            return -1;
+        }
+        *far_end = accept(listener, NULL, NULL);
+        close(listener);
+        if (*far_end < 0) {
+            perror("accept: ");
+            return -1;
+        }
+        break;
+    }
+    }
+    if (pthread_create(consumer, NULL, drain_output, far_end)) {
+        perror("pthread_create: ");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int format = REPORT_TEXT;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:o:b:q:T:f:")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (!strcmp(optarg, "splice")) {
+                mode = MODE_SPLICE;
+            } else if (!strcmp(optarg, "tee")) {
+                mode = MODE_TEE;
+            } else if (!strcmp(optarg, "sendzc")) {
+                mode = MODE_SENDZC;
+            } else if (!strcmp(optarg, "copy")) {
+                mode = MODE_COPY;
+            } else if (!strcmp(optarg, "rw")) {
+                mode = MODE_RW;
+            } else {
+                fprintf(stderr, "unknown mode: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'o':
+            if (!strcmp(optarg, "stdout")) {
+                output = OUT_STDOUT;
+            } else if (!strcmp(optarg, "pipe")) {
+                output = OUT_PIPE;
+            } else if (!strcmp(optarg, "unix")) {
+                output = OUT_UNIX;
+            } else if (!strcmp(optarg, "tcp")) {
+                output = OUT_TCP;
+            } else {
+                fprintf(stderr, "unknown output: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'b':
+            chunk_size = parse_size(optarg);
+            break;
+        case 'q':
+            depth = strtoul(optarg, NULL, 0);
+            break;
+        case 'T':
+            mirror_path = optarg;
+            break;
+        case 'f':
+            format = parse_report_format(optarg);
+            if (format < 0) {
+                fprintf(stderr, "unknown format: %s\n", optarg);
+                return -1;
+            }
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            return -1;
+        }
+    }
+    if (optind >= argc || !chunk_size || chunk_size > UINT32_MAX || depth < 4) {
+        fprintf(stderr, USAGE, argv[0]);
+        return -1;
+    }
+    if (output == OUT_STDOUT && format != REPORT_TEXT) {
+        fprintf(stderr, "csv and json reports go to stdout, stream to pipe, unix or tcp instead\n");
+        return -1;
+    }
+    if (mode == MODE_SENDZC && output != OUT_TCP) {
+        fprintf(stderr, "sendzc needs a tcp output, af_unix has no zero-copy send\n");
+        return -1;
+    }
+
+    file_fd = open(argv[optind], O_RDONLY);
+    if (file_fd < 0) {
+        perror("open: ");
+        return -1;
+    }
+    struct stat st;
+    fstat(file_fd, &st);
+    file_size = st.st_size;
+
+    pthread_t consumer;
+    int far_end = -1;
+    if (open_output(&consumer, &far_end)) {
+        return -1;
+    }
+    struct stat out_st;
+    fstat(out_fd, &out_st);
+    out_is_pipe = S_ISFIFO(out_st.st_mode);
+    if (mode == MODE_TEE && !out_is_pipe) {
+        fprintf(stderr, "tee needs a pipe output\n");
+        return -1;
+    }
+    if (mode == MODE_SPLICE || mode == MODE_TEE) {
+        if (pipe(pipe_fds)) {
+            perror("pipe: ");
+            return -1;
+        }
+        // a chunk must fit in the pipe, or every splice into it comes up short
+        int size = fcntl(pipe_fds[1], F_SETPIPE_SZ, chunk_size);
+        if (size > 0 && (size_t)size < chunk_size) {
+            chunk_size = size;
+        } else if (size < 0) {
+            chunk_size = fcntl(pipe_fds[1], F_GETPIPE_SZ);
+        }
+    }
+    if (mode == MODE_TEE) {
+        mirror_fd = open(mirror_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (mirror_fd < 0) {
+            perror("open mirror: ");
+            return -1;
+        }
+    }
+
+    hist_init(&latency);
+    result.block_size = chunk_size;
+    int ret = mode == MODE_RW ? stream_rw() : stream_ring();
+
+    if (output != OUT_STDOUT) {
+        close(out_fd); // the consumer sees eof
+        pthread_join(consumer, NULL);
+    }
+    if (delivered != file_size) {
+        fprintf(stderr, "delivered %zu of %zu bytes\n", delivered, file_size);
+        ret = -1;
+    }
+    bench_fill_latency(&result, &latency);
+    FILE *out = output == OUT_STDOUT ? stderr : stdout; // keep the stream clean
+    report_result(out, format, &result);
+    if (format == REPORT_TEXT) {
+        hist_print(out, &latency);
+    }
+    return ret ? -1 : 0;
+}
@@ -6,8 +6,12 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <dirent.h>
 #include <liburing.h>
+#include <limits.h>
 #include <linux/io_uring.h>
+#include <pthread.h>
 #include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,165 +20,1691 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
-#define BUF_SIZE 4096
-#define ENTRIES 8
+#include "bench.h"
+#include "buf_pool.h"
+#include "crc32c.h"
+#include "engine/engine.h"
+#include "pattern.h"
+#include "spsc.h"
 
+#define BUF_SIZE 4096 // default block size
+#define ENTRIES 8 // default submission queue depth
+#define MAX_FIXED_BUF_SIZE (1ul << 30) // kernel limit for one registered buffer
+#define MAX_THREADS 256
+#define REAP_BATCH 256 // completions handled per peek
+#define MAX_COALESCE 256 // adjacent blocks merged into one request
+#define MAX_PBUFS 32768 // entries of a provided buffer ring
+#define PBUF_GROUP 0 // buffer group id of the provided buffer ring
+#define MAX_MISMATCHES_SHOWN 10 // checksum mismatches printed per worker
+#define VERIFY_SPINS 1024 // empty polls of the verifier before it sleeps
+#define MAX_RETRIES 8 // -EAGAIN / -EINTR retries of one read before it fails
+
+struct worker;
+
+/**
+ * one in-flight read, bound to a buffer pool slot, or with --pbuf-ring to
+ * whichever provided buffer the kernel picks. the sqe user_data points here
+ * and the completion is dispatched to complete().
+ */
 struct buf_info {
-    off_t offset; // fd offset
-    size_t len;   // buffer length
-    char *buf;    // buffer
+    unsigned file;      // fixed file index
+    off_t offset;       // fd offset
+    size_t len;         // buffer length
+    char *buf;          // buffer
+    unsigned nr_blocks; // adjacent blocks covered by the read
+    struct iovec *iov;  // one iovec per block for IORING_OP_READV
+    unsigned slot;      // buffer pool slot
+    int buf_index;      // registered buffer holding buf
+    uint64_t submit_ns; // submission timestamp
+    int res;            // bytes read, for the verifier
+    size_t done;        // bytes of the request read so far
+    size_t pos;         // request offset of the outstanding read, done rounded down to a block
+    unsigned retries;   // -EAGAIN / -EINTR retries so far
+    struct buf_info *next; // idle or parked list link, --pbuf-ring only
+    void (*complete)(struct worker *w, struct buf_info *buf_info, int res, unsigned flags); // completion handler
 };
 
+/**
+ * one input file. the blocks of all files form one global block range, in
+ * the order the files were given, which the workers shard and the access
+ * pattern walks.
+ */
 struct file_info {
-    int fd;                    // file descriptor
-    size_t file_size;          // file size
-    size_t blocks;             // file blocks
-    struct buf_info buffers[]; // buffers
+    char *path;         // file name
+    size_t file_size;   // file size
+    size_t blocks;      // file blocks
+    size_t first_block; // global index of the file's first block
 };
 
-int open_file(char *filename) {
-    int fd = open(filename, O_RDONLY | O_DIRECT); // | O_DIRECT);
-    if (fd < 0) {
-        perror("open: ");
-        exit(-1);
+/**
+ * per-thread reader state. every worker owns a ring, a buffer pool and a
+ * contiguous shard of the file's blocks. with --pbuf-ring the pool backs the
+ * provided buffer ring and holds opts.pbufs buffers, whatever the in-flight
+ * limit is.
+ */
+struct worker {
+    int id;                      // worker index
+    int cpu;                     // cpu the worker is pinned to
+    pthread_t thread;            // worker thread
+    struct io_uring io_uring;    // private ring
+    int fixed_buffers;           // buffers registered, reads use READ_FIXED
+    int *fds;                    // pread path: descriptor per file, -1 outside the shard
+    size_t first_block;          // first block of the shard
+    size_t nr_blocks;            // blocks in the shard
+    struct pattern pattern;      // access order within the shard
+    unsigned inflight;           // submitted but not yet completed requests
+    struct buf_pool pool;        // one buffer per in-flight request, or the provided buffers
+    struct buf_info *requests;   // request state per pool slot, or per in-flight request
+    struct io_uring_buf_ring *buf_ring; // provided buffer ring, --pbuf-ring only
+    struct buf_info *idle;       // requests free to issue, --pbuf-ring only
+    struct buf_info *parked;     // reads refused with ENOBUFS, waiting for a buffer
+    unsigned nr_parked;          // entries on the parked list
+    unsigned pbufs_recycled;     // buffers handed back but not yet published to the kernel
+    size_t enobufs;              // reads that found the provided buffer ring empty
+    pthread_t verifier;          // checksum thread, --verify only
+    struct spsc_queue to_verify; // completed reads, worker -> verifier
+    struct spsc_queue verified;  // checked reads whose buffers can be reused, verifier -> worker
+    unsigned verifying;          // reads handed to the verifier and not yet back
+    int verify_stop;             // set once the shard is done and every read came back
+    int verifier_idle;           // the verifier sleeps on verify_cond, push must wake it
+    pthread_mutex_t verify_lock; // protects the sleep, not the queues
+    pthread_cond_t verify_cond;
+    size_t blocks_verified;      // blocks whose checksum was compared
+    size_t mismatches;           // blocks whose checksum did not match the sidecar
+    struct histogram latency;    // per-request latency
+    struct bench_result result;  // shard totals
+    size_t sq_wakeups;           // submits that found the sq thread asleep
+    size_t cq_overflows;         // reaps that found the cq ring overflowing
+    size_t sqes_saved;           // reads merged into a neighbour's sqe
+    unsigned cq_dropped;         // completions the kernel had to drop
+    size_t short_reads;          // reads that returned less than asked and were continued
+    size_t retried;              // reads retried after -EAGAIN or -EINTR
+    size_t failed;               // reads given up on, their bytes are missing from the result
+    int ret;                     // worker exit status
+};
+
+struct options {
+    unsigned depth;        // submission queue entries
+    unsigned cq_size;      // completion queue entries, 0 for the kernel default
+    unsigned inflight;     // maximum requests in flight
+    size_t block_size;     // bytes per read
+    int fixed_buffers;     // register the buffer pool and use IORING_OP_READ_FIXED
+    unsigned coalesce;     // merge up to this many adjacent blocks into one sqe
+    int sqpoll;            // use a kernel submission polling thread
+    int threads;           // worker threads, one ring each
+    int cpus[MAX_THREADS]; // cpu of each worker
+    int nr_cpus;           // entries in cpus, 0 pins worker i to cpu i
+    int single_issuer;     // IORING_SETUP_SINGLE_ISSUER
+    int defer_taskrun;     // IORING_SETUP_DEFER_TASKRUN
+    int iopoll;            // IORING_SETUP_IOPOLL, busy-poll the device for completions
+    int attach_wq;         // attach every ring to the first ring's sq thread
+    int sq_cpus[MAX_THREADS]; // cpu of each ring's sq thread
+    int nr_sq_cpus;        // entries in sq_cpus, 0 leaves the sq thread unpinned
+    unsigned sq_idle;      // ms the sq thread spins before sleeping
+    unsigned pbufs;        // provided buffer ring entries, 0 binds a buffer to every sqe
+    int verify;            // check every block against its sidecar checksum
+    int make_checksums;    // write the sidecars instead of reading
+    int auto_tune;         // start the probe ladder at sqpoll + iopoll + fixed buffers
+    struct pattern pattern; // block access pattern
+    int format;            // result report format
+};
+
+static struct options opts = {
+    .depth = ENTRIES,
+    .block_size = BUF_SIZE,
+    .coalesce = 1,
+    .sqpoll = 1,
+    .threads = 1,
+    .sq_cpus = {1},
+    .nr_sq_cpus = 1,
+    .sq_idle = 2000,
+    .format = REPORT_TEXT,
+};
+
+static struct file_info *files; // input files, fixed file index = array index
+static unsigned nr_files;
+static size_t total_blocks;     // blocks of all files
+static uint32_t *checksums;     // expected crc32c per global block, --verify only
+
+/**
+ * how the workers read, picked at startup by probe_features() from what the
+ * kernel accepts. opts is trimmed to the same ladder step.
+ */
+enum io_path {
+    IO_PATH_RING,  // io_uring with the options that survived the probe
+    IO_PATH_PREAD, // no usable io_uring, every worker preads its shard
+};
+static int io_path = IO_PATH_RING;
+static int sparse_files = 1; // sparse fixed file tables, 5.19
+static int async_open = 1;   // OPENAT straight into the fixed file table, 5.15
+static int open_flags = O_RDONLY | O_DIRECT; // buffered when the filesystem refuses O_DIRECT
+
+static pthread_barrier_t start_barrier; // workers start reading together
+
+/**
+ * with --attach-wq the first worker publishes its ring fd here and the other
+ * workers wait for it before creating their rings
+ */
+static pthread_mutex_t wq_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wq_cond = PTHREAD_COND_INITIALIZER;
+static int wq_fd = -1;      // ring fd of worker 0
+static int wq_published;    // worker 0 finished setting up, wq_fd < 0 on failure
+
+void publish_wq(int fd) {
+    pthread_mutex_lock(&wq_lock);
+    wq_fd = fd;
+    wq_published = 1;
+    pthread_cond_broadcast(&wq_cond);
+    pthread_mutex_unlock(&wq_lock);
+}
+
+int wait_wq(void) {
+    pthread_mutex_lock(&wq_lock);
+    while (!wq_published) {
+        pthread_cond_wait(&wq_cond, &wq_lock);
     }
+    int fd = wq_fd;
+    pthread_mutex_unlock(&wq_lock);
     return fd;
 }
 
-size_t get_file_size(int fd) {
-    struct stat stat;
-    int ret = fstat(fd, &stat);
-    if (ret != 0) {
-        perror("fstat: ");
-        exit(-ret);
+/**
+ * index of the file holding global block
+ */
+unsigned file_of_block(size_t block) {
+    unsigned lo = 0, hi = nr_files - 1;
+    while (lo < hi) {
+        unsigned mid = (lo + hi + 1) / 2;
+        if (files[mid].first_block <= block) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+int requeue_parked(struct worker *w);
+
+/**
+ * hand provided buffer bid back to the kernel. the ring tail is published
+ * once per reaped batch, not per buffer.
+ */
+void recycle_pbuf(struct worker *w, unsigned bid) {
+    io_uring_buf_ring_add(w->buf_ring, buf_pool_slot(&w->pool, bid), opts.block_size, bid,
+                          io_uring_buf_ring_mask(opts.pbufs), w->pbufs_recycled++);
+}
+
+/**
+ * the data of a finished read was consumed: recycle its buffer, and with
+ * --pbuf-ring put the request back on the idle list
+ */
+void release_buffer(struct worker *w, struct buf_info *buf_info) {
+    if (!opts.pbufs) {
+        buf_pool_put(&w->pool, buf_info->slot);
+        return;
+    }
+    if (buf_info->buf) {
+        recycle_pbuf(w, buf_info->slot);
+        buf_info->buf = NULL;
+    }
+    buf_info->next = w->idle;
+    w->idle = buf_info;
+}
+
+/**
+ * wake the verifier if it went to sleep on an empty queue. the fence orders
+ * the push before the idle check, pairing with the one in verify_main.
+ */
+void wake_verifier(struct worker *w) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&w->verifier_idle, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&w->verify_lock);
+        pthread_cond_signal(&w->verify_cond);
+        pthread_mutex_unlock(&w->verify_lock);
+    }
+}
+
+int queue_read(struct worker *w, struct buf_info *buf_info);
+
+/**
+ * bytes a request can return: its length, less at the end of the file
+ */
+size_t read_size(const struct buf_info *buf_info) {
+    size_t left = files[buf_info->file].file_size - buf_info->offset;
+    return left < buf_info->len ? left : buf_info->len;
+}
+
+/**
+ * completion handler of a block read: account it, then recycle the buffer
+ * or, with --verify, pass it on to the verifier which sends it back.
+ * -EAGAIN / -EINTR are retried and short reads continued, only bytes that
+ * were really read count.
+ */
+void read_done(struct worker *w, struct buf_info *buf_info, int res, unsigned flags) {
+    if (opts.pbufs && res == -ENOBUFS) {
+        // every provided buffer is taken, retry once reads hand some back
+        w->enobufs++;
+        buf_info->next = w->parked;
+        w->parked = buf_info;
+        w->nr_parked++;
+        return;
+    }
+    if (flags & IORING_CQE_F_BUFFER) {
+        // the kernel's pick, it stays with the request until released
+        buf_info->slot = flags >> IORING_CQE_BUFFER_SHIFT;
+        buf_info->buf = buf_pool_slot(&w->pool, buf_info->slot);
+    }
+    if ((res == -EAGAIN || res == -EINTR) && buf_info->retries < MAX_RETRIES) {
+        // transient, e.g. IOPOLL without a free request slot in the driver
+        buf_info->retries++;
+        w->retried++;
+        if (queue_read(w, buf_info)) {
+            w->ret = -1;
+        }
+        return;
+    }
+    if (res > 0 && buf_info->pos + res > buf_info->done && buf_info->pos + res < read_size(buf_info)) {
+        // O_DIRECT continues from a block boundary, the partial block is read again
+        w->result.bytes += buf_info->pos + res - buf_info->done;
+        buf_info->done = buf_info->pos + res;
+        buf_info->pos = buf_info->done / opts.block_size * opts.block_size;
+        w->short_reads++;
+        if (queue_read(w, buf_info)) {
+            w->ret = -1;
+        }
+        return;
+    }
+    hist_record(&w->latency, hist_now_ns() - buf_info->submit_ns);
+    w->inflight--;
+    if (res == -EOPNOTSUPP && opts.iopoll) {
+        // every other read would fail the same way, stop the shard
+        if (!w->ret) {
+            fprintf(stderr, "worker %d: the file's device does not support polled i/o\n", w->id);
+        }
+        w->ret = res;
+    } else if (res < 0) {
+        fprintf(stderr, "worker %d: read: %s at offset %ld\n", w->id, strerror(-res),
+                buf_info->offset + buf_info->pos);
+        w->failed++;
+    } else if (buf_info->pos + res <= buf_info->done && buf_info->done < read_size(buf_info)) {
+        // nothing new, a continuation may only re-read the partial block of the previous part
+        fprintf(stderr, "worker %d: unexpected EOF at offset %ld, the file shrank\n", w->id,
+                buf_info->offset + buf_info->done);
+        w->failed++;
+    } else {
+        w->result.bytes += buf_info->pos + res - buf_info->done;
+        buf_info->done = buf_info->pos + res;
+        w->result.ops += (buf_info->done + opts.block_size - 1) / opts.block_size; // ops count blocks, not sqes
+        if (opts.verify) {
+            buf_info->res = buf_info->done;
+            w->verifying++;
+            spsc_push(&w->to_verify, buf_info); // sized for every request, never full
+            wake_verifier(w);
+            return;
+        }
+    }
+    release_buffer(w, buf_info);
+}
+
+/**
+ * compare the blocks of a completed read with their sidecar checksums. a
+ * partial block only counts at the end of the file, a short read elsewhere
+ * has nothing to compare.
+ */
+void verify_read(struct worker *w, struct buf_info *buf_info) {
+    struct file_info *file = &files[buf_info->file];
+    size_t block = file->first_block + buf_info->offset / opts.block_size;
+    for (size_t pos = 0; pos < (size_t)buf_info->res; pos += opts.block_size, block++) {
+        size_t len = buf_info->res - pos < opts.block_size ? buf_info->res - pos : opts.block_size;
+        if (len < opts.block_size && buf_info->offset + pos + len != file->file_size) {
+            break;
+        }
+        w->blocks_verified++;
+        if (crc32c(buf_info->buf + pos, len) != checksums[block] && w->mismatches++ < MAX_MISMATCHES_SHOWN) {
+            fprintf(stderr, "worker %d: checksum mismatch in %s at offset %zu\n", w->id, file->path,
+                    (size_t)buf_info->offset + pos);
+        }
+    }
+}
+
+/**
+ * verifier thread: checks reads in completion order and hands their buffers
+ * back, until the worker sets verify_stop. it polls the queue for a while
+ * and then sleeps, so it does not take cpu time from the sq thread and the
+ * worker while the device is the bottleneck.
+ */
+void *verify_main(void *arg) {
+    struct worker *w = arg;
+    unsigned spins = 0;
+    for (;;) {
+        struct buf_info *buf_info = spsc_pop(&w->to_verify);
+        if (buf_info) {
+            verify_read(w, buf_info);
+            spsc_push(&w->verified, buf_info);
+            spins = 0;
+            continue;
+        }
+        if (__atomic_load_n(&w->verify_stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        if (++spins < VERIFY_SPINS) {
+            continue;
+        }
+        pthread_mutex_lock(&w->verify_lock);
+        __atomic_store_n(&w->verifier_idle, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        // recheck after announcing the sleep, a push may have raced with it
+        while (spsc_empty(&w->to_verify) && !__atomic_load_n(&w->verify_stop, __ATOMIC_ACQUIRE)) {
+            pthread_cond_wait(&w->verify_cond, &w->verify_lock);
+        }
+        __atomic_store_n(&w->verifier_idle, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&w->verify_lock);
+        spins = 0;
+    }
+    return NULL;
+}
+
+/**
+ * take back the reads the verifier is done with. returns how many.
+ */
+unsigned collect_verified(struct worker *w) {
+    unsigned nr = 0;
+    struct buf_info *buf_info;
+    while ((buf_info = spsc_pop(&w->verified))) {
+        release_buffer(w, buf_info);
+        w->verifying--;
+        nr++;
+    }
+    if (nr && w->pbufs_recycled) {
+        requeue_parked(w);
+    }
+    return nr;
+}
+
+/**
+ * reap every completion that is ready in one pass and hand each one to its
+ * request's handler. with wait set, block until at least one is ready.
+ * returns the number of completions reaped.
+ */
+int reap_cqes(struct worker *w, int wait) {
+    struct io_uring *io_uring = &w->io_uring;
+    struct io_uring_cqe *cqes[REAP_BATCH];
+    if (io_uring_cq_has_overflow(io_uring)) {
+        // completions are parked in the kernel until the next io_uring_enter
+        w->cq_overflows++;
+    }
+    if (wait) {
+        int ret = io_uring_wait_cqe(io_uring, &cqes[0]);
+        if (ret < 0) {
+            fprintf(stderr, "io_uring_wait_cqe: %s\n", strerror(-ret));
+            return ret;
+        }
+    }
+    unsigned nr = io_uring_peek_batch_cqe(io_uring, cqes, REAP_BATCH);
+    for (unsigned i = 0; i < nr; i++) {
+        struct buf_info *buf_info = io_uring_cqe_get_data(cqes[i]);
+        buf_info->complete(w, buf_info, cqes[i]->res, cqes[i]->flags);
+    }
+    io_uring_cq_advance(io_uring, nr); // release all of them with one head update
+    if (w->parked || w->pbufs_recycled) {
+        requeue_parked(w);
+    }
+    return nr;
+}
+
+/**
+ * submit the queued sqes. with sqpoll this is only a wakeup call when the
+ * sq thread went to sleep after sq_idle ms without work, count those.
+ */
+int submit(struct worker *w) {
+    if ((w->io_uring.flags & IORING_SETUP_SQPOLL) &&
+        (IO_URING_READ_ONCE(*w->io_uring.sq.kflags) & IORING_SQ_NEED_WAKEUP)) {
+        w->sq_wakeups++;
+    }
+    return io_uring_submit(&w->io_uring);
+}
+
+/**
+ * queue the sqe of a prepared request. with sqpoll the sqe is published
+ * right away, it only costs a tail update.
+ */
+int queue_read(struct worker *w, struct buf_info *buf_info) {
+    struct io_uring *io_uring = &w->io_uring;
+    struct io_uring_sqe *sqe = io_uring_get_sqe(io_uring);
+    while (!sqe) {
+        // sq is full of unconsumed entries, push them to the kernel first.
+        // the sq thread consumes them asynchronously, wait until it made room
+        submit(w);
+        int ret = io_uring_sqring_wait(io_uring);
+        if (ret < 0) {
+            fprintf(stderr, "io_uring_sqring_wait: %s\n", strerror(-ret));
+            return ret;
+        }
+        sqe = io_uring_get_sqe(io_uring);
+    }
+    unsigned flags = IOSQE_FIXED_FILE;
+    // a continued short read covers the rest of the request from pos
+    char *buf = buf_info->buf + buf_info->pos;
+    unsigned len = buf_info->len - buf_info->pos;
+    off_t offset = buf_info->offset + buf_info->pos;
+    if (opts.pbufs && !buf_info->buf) {
+        // no buffer yet, the kernel takes one from the group when the read runs
+        io_uring_prep_read(sqe, buf_info->file, NULL, buf_info->len, buf_info->offset);
+        sqe->buf_group = PBUF_GROUP;
+        flags |= IOSQE_BUFFER_SELECT;
+    } else if (w->fixed_buffers) {
+        // the blocks of a slot are contiguous, one fixed read covers them all
+        io_uring_prep_read_fixed(sqe, buf_info->file, buf, len, offset, buf_info->buf_index);
+    } else if (buf_info->nr_blocks > 1 && !buf_info->pos) {
+        io_uring_prep_readv(sqe, buf_info->file, buf_info->iov, buf_info->nr_blocks, buf_info->offset);
+    } else {
+        io_uring_prep_read(sqe, buf_info->file, buf, len, offset);
+    }
+    io_uring_sqe_set_flags(sqe, flags);
+    io_uring_sqe_set_data(sqe, buf_info);
+    if ((io_uring->flags & IORING_SETUP_SQPOLL) || !io_uring_sq_space_left(io_uring)) {
+        submit(w);
+    }
+    return 0;
+}
+
+/**
+ * publish the recycled provided buffers and reissue parked reads, one per
+ * buffer handed back. when nothing else is in flight or being verified no
+ * read holds a buffer, so all of them are reissued, otherwise nothing would
+ * complete to wake us.
+ */
+int requeue_parked(struct worker *w) {
+    unsigned nr = w->nr_parked == w->inflight && !w->verifying ? w->nr_parked : w->pbufs_recycled;
+    if (w->pbufs_recycled) {
+        io_uring_buf_ring_advance(w->buf_ring, w->pbufs_recycled);
+        w->pbufs_recycled = 0;
+    }
+    for (; nr && w->parked; nr--) {
+        struct buf_info *buf_info = w->parked;
+        w->parked = buf_info->next;
+        w->nr_parked--;
+        int ret = queue_read(w, buf_info);
+        if (ret) {
+            return ret;
+        }
+    }
+    if (io_uring_sq_ready(&w->io_uring)) {
+        submit(w);
+    }
+    return 0;
+}
+
+/**
+ * wait until a request is free: reap a completion, or take back a read from
+ * the verifier when it holds all the others
+ */
+void wait_request(struct worker *w) {
+    if (w->verifying && collect_verified(w)) {
+        return;
+    }
+    if (w->inflight == w->nr_parked) {
+        sched_yield(); // nothing is in the kernel, the reads wait for the verifier
+        return;
+    }
+    if (io_uring_sq_ready(&w->io_uring)) {
+        submit(w);
+    }
+    reap_cqes(w, 1);
+}
+
+/**
+ * pread path of read_blocks(): read nr adjacent blocks of file into the
+ * worker's only buffer and account them like a completion
+ */
+int pread_blocks(struct worker *w, unsigned file, off_t offset, unsigned nr) {
+    struct buf_info *buf_info = &w->requests[0];
+    buf_info->file = file;
+    buf_info->offset = offset;
+    buf_info->len = nr * opts.block_size;
+    buf_info->done = buf_info->pos = 0;
+    buf_info->retries = 0;
+    size_t expected = read_size(buf_info);
+    uint64_t start = hist_now_ns();
+    while (buf_info->done < expected) {
+        ssize_t res = pread(w->fds[file], buf_info->buf + buf_info->pos, buf_info->len - buf_info->pos,
+                            offset + buf_info->pos);
+        if (res < 0 && (errno == EAGAIN || errno == EINTR) && buf_info->retries < MAX_RETRIES) {
+            buf_info->retries++;
+            w->retried++;
+            continue;
+        }
+        if (res < 0) {
+            fprintf(stderr, "worker %d: pread: %s at offset %ld\n", w->id, strerror(errno), offset + buf_info->pos);
+            w->failed++;
+            break;
+        }
+        if (buf_info->pos + res <= buf_info->done) {
+            fprintf(stderr, "worker %d: unexpected EOF at offset %ld, the file shrank\n", w->id,
+                    offset + buf_info->done);
+            w->failed++;
+            break;
+        }
+        w->result.bytes += buf_info->pos + res - buf_info->done;
+        buf_info->done = buf_info->pos + res;
+        if (buf_info->done < expected) {
+            // same as a ring read, continue from a block boundary
+            buf_info->pos = buf_info->done / opts.block_size * opts.block_size;
+            w->short_reads++;
+        }
+    }
+    hist_record(&w->latency, hist_now_ns() - start);
+    w->result.ops += (buf_info->done + opts.block_size - 1) / opts.block_size;
+    if (opts.verify && buf_info->done) {
+        buf_info->res = buf_info->done;
+        verify_read(w, buf_info);
+    }
+    return 0;
+}
+
+/**
+ * queue a read of nr adjacent blocks at offset of fixed file fd into a free
+ * pool buffer, keeping at most opts.inflight requests outstanding, counting
+ * the ones still being verified.
+ */
+int read_blocks(struct worker *w, unsigned fd, off_t offset, unsigned nr) {
+    if (io_path == IO_PATH_PREAD) {
+        return pread_blocks(w, fd, offset, nr);
+    }
+    while (w->inflight + w->verifying >= opts.inflight) {
+        wait_request(w);
+    }
+    // reap whatever already completed without blocking
+    reap_cqes(w, 0);
+
+    // the in-flight limit equals the number of requests, so one is free now
+    struct buf_info *buf_info;
+    if (opts.pbufs) {
+        buf_info = w->idle;
+        w->idle = buf_info->next;
+    } else {
+        buf_info = &w->requests[buf_pool_get(&w->pool)];
+    }
+    buf_info->file = fd;
+    buf_info->offset = offset;
+    // the tail block is read in full as O_DIRECT needs an aligned length, the read stops at EOF
+    buf_info->len = nr * opts.block_size;
+    buf_info->nr_blocks = nr;
+    buf_info->done = buf_info->pos = 0;
+    buf_info->retries = 0;
+    buf_info->complete = read_done;
+    buf_info->submit_ns = hist_now_ns(); // a parked read keeps its first submission time
+    w->sqes_saved += nr - 1;
+    w->inflight++;
+    return queue_read(w, buf_info);
+}
+
+/**
+ * read the worker's shard in the order of its access pattern. runs of
+ * consecutive blocks of one file, up to opts.coalesce long, become one request.
+ */
+int read_file(struct worker *w) {
+    size_t i = 0;
+    size_t block = w->nr_blocks ? w->first_block + pattern_block(&w->pattern, 0) : 0;
+    while (i < w->nr_blocks && !w->ret) {
+        size_t first = block;
+        struct file_info *file = &files[file_of_block(first)];
+        size_t file_end = file->first_block + file->blocks;
+        unsigned nr = 1;
+        // the pattern is consumed in order, the block that ends a run starts the next one
+        while (++i < w->nr_blocks) {
+            block = w->first_block + pattern_block(&w->pattern, i);
+            if (nr == opts.coalesce || block != first + nr || block >= file_end) {
+                break;
+            }
+            nr++;
+        }
+        if (read_blocks(w, file - files, (first - file->first_block) * opts.block_size, nr)) {
+            w->ret = -1;
+            break;
+        }
+    }
+    if (io_path == IO_PATH_PREAD) {
+        return w->ret;
+    }
+    submit(w); // flush the partially filled sq
+    while (w->inflight || w->verifying) {
+        wait_request(w);
+    }
+    w->cq_dropped = IO_URING_READ_ONCE(*w->io_uring.cq.koverflow);
+    return w->ret;
+}
+
+/**
+ * completion handler of an IORING_OP_OPENAT into the fixed file table
+ */
+void open_done(struct worker *w, struct buf_info *buf_info, int res, unsigned flags) {
+    w->inflight--;
+    if (res < 0) {
+        fprintf(stderr, "worker %d: open %s: %s\n", w->id, files[buf_info->file].path, strerror(-res));
+        w->ret = res;
+    }
+}
+
+/**
+ * register an empty fixed file table of nr slots. kernels before 5.19
+ * cannot register a sparse table, they get an array of -1 descriptors.
+ */
+int register_file_table(struct io_uring *ring, unsigned nr) {
+    if (sparse_files) {
+        return io_uring_register_files_sparse(ring, nr);
+    }
+    int *fds = malloc(nr * sizeof(int));
+    if (!fds) {
+        return -ENOMEM;
+    }
+    memset(fds, -1, nr * sizeof(int));
+    int ret = io_uring_register_files(ring, fds, nr);
+    free(fds);
+    return ret;
+}
+
+/**
+ * register a sparse fixed file table for all files and open the ones the
+ * shard touches straight into it. the opens are queued asynchronously, up
+ * to the sq depth at a time, so thousands of files do not serialize on
+ * open(2). iopoll rings cannot run OPENAT, and kernels before 5.15 cannot
+ * open into the table, they open synchronously and install the descriptors
+ * with a table update.
+ */
+int open_files(struct worker *w) {
+    int ret = register_file_table(&w->io_uring, nr_files);
+    if (ret) {
+        fprintf(stderr, "worker %d: register_file_table: %s\n", w->id, strerror(-ret));
+        return ret;
+    }
+    if (!w->nr_blocks) {
+        return 0;
+    }
+    unsigned first = file_of_block(w->first_block);
+    unsigned last = file_of_block(w->first_block + w->nr_blocks - 1);
+
+    if (opts.iopoll || !async_open) {
+        for (unsigned i = first; i <= last; i++) {
+            int fd = open(files[i].path, open_flags);
+            if (fd < 0) {
+                fprintf(stderr, "worker %d: open %s: %s\n", w->id, files[i].path, strerror(errno));
+                return -errno;
+            }
+            ret = io_uring_register_files_update(&w->io_uring, i, &fd, 1);
+            close(fd); // the table holds its own reference
+            if (ret < 0) {
+                fprintf(stderr, "worker %d: io_uring_register_files_update: %s\n", w->id, strerror(-ret));
+                return ret;
+            }
+        }
+        return 0;
+    }
+
+    struct buf_info *opens = calloc(last - first + 1, sizeof(struct buf_info));
+    if (!opens) {
+        return -ENOMEM;
+    }
+    for (unsigned i = first; i <= last && !w->ret; i++) {
+        struct io_uring_sqe *sqe;
+        while (!(sqe = io_uring_get_sqe(&w->io_uring))) {
+            submit(w);
+            io_uring_sqring_wait(&w->io_uring);
+            reap_cqes(w, 0);
+        }
+        struct buf_info *req = &opens[i - first];
+        req->file = i;
+        req->complete = open_done;
+        io_uring_prep_openat_direct(sqe, AT_FDCWD, files[i].path, open_flags, 0, i);
+        io_uring_sqe_set_data(sqe, req);
+        w->inflight++;
+    }
+    submit(w);
+    while (w->inflight) {
+        reap_cqes(w, 1);
+    }
+    free(opens);
+    return w->ret;
+}
+
+/**
+ * register the buffer pool so the kernel pins its pages once instead of on
+ * every read. the arena is split into 1 GiB iovecs, the per-buffer maximum.
+ */
+int register_buffers(struct worker *w) {
+    struct buf_pool *pool = &w->pool;
+    unsigned nr_iovecs = (pool->arena_size + MAX_FIXED_BUF_SIZE - 1) / MAX_FIXED_BUF_SIZE;
+    struct iovec *iovecs = calloc(nr_iovecs, sizeof(struct iovec));
+    if (!iovecs) {
+        return -ENOMEM;
+    }
+    for (unsigned i = 0; i < nr_iovecs; i++) {
+        size_t offset = i * MAX_FIXED_BUF_SIZE;
+        iovecs[i].iov_base = pool->arena + offset;
+        iovecs[i].iov_len = pool->arena_size - offset < MAX_FIXED_BUF_SIZE ? pool->arena_size - offset : MAX_FIXED_BUF_SIZE;
+    }
+    int ret = io_uring_register_buffers(&w->io_uring, iovecs, nr_iovecs);
+    free(iovecs);
+    if (ret) {
+        return ret;
+    }
+    // block size divides 1 GiB, so no buffer straddles two iovecs
+    for (unsigned i = 0; i < pool->nr_slots; i++) {
+        w->requests[i].buf_index = (w->requests[i].buf - pool->arena) / MAX_FIXED_BUF_SIZE;
+    }
+    return 0;
+}
+
+/**
+ * register a ring of opts.pbufs provided buffers, one block each, and fill
+ * it. requests carry no buffer, they are kept on the idle list.
+ */
+int prepare_pbuf_ring(struct worker *w) {
+    if (buf_pool_init(&w->pool, opts.pbufs, opts.block_size)) {
+        return -1;
+    }
+    int ret;
+    w->buf_ring = io_uring_setup_buf_ring(&w->io_uring, opts.pbufs, PBUF_GROUP, 0, &ret);
+    if (!w->buf_ring) {
+        fprintf(stderr, "worker %d: io_uring_setup_buf_ring: %s\n", w->id, strerror(-ret));
+        return -1;
+    }
+    for (unsigned bid = 0; bid < opts.pbufs; bid++) {
+        recycle_pbuf(w, bid);
+    }
+    io_uring_buf_ring_advance(w->buf_ring, w->pbufs_recycled);
+    w->pbufs_recycled = 0;
+
+    w->requests = calloc(opts.inflight, sizeof(struct buf_info));
+    if (!w->requests) {
+        return -1;
+    }
+    for (unsigned i = 0; i < opts.inflight; i++) {
+        w->requests[i].next = w->idle;
+        w->idle = &w->requests[i];
+    }
+    return 0;
+}
+
+/**
+ * one pool slot per in-flight request, holding opts.coalesce contiguous
+ * blocks. each block keeps its own iovec for vectored reads.
+ */
+int prepare_buffers(struct worker *w) {
+    if (opts.pbufs) {
+        return prepare_pbuf_ring(w);
+    }
+    if (buf_pool_init(&w->pool, opts.inflight, opts.block_size * opts.coalesce)) {
+        return -1;
+    }
+    w->requests = calloc(opts.inflight, sizeof(struct buf_info));
+    struct iovec *iovecs = calloc((size_t)opts.inflight * opts.coalesce, sizeof(struct iovec));
+    if (!w->requests || !iovecs) {
+        return -1;
+    }
+    for (unsigned i = 0; i < opts.inflight; i++) {
+        w->requests[i].slot = i;
+        w->requests[i].buf = buf_pool_slot(&w->pool, i);
+        w->requests[i].iov = &iovecs[(size_t)i * opts.coalesce];
+        for (unsigned b = 0; b < opts.coalesce; b++) {
+            w->requests[i].iov[b].iov_base = w->requests[i].buf + b * opts.block_size;
+            w->requests[i].iov[b].iov_len = opts.block_size;
+        }
     }
-    return stat.st_size;
+    return 0;
 }
 
-int check_cqe(struct io_uring *io_uring) {
+/**
+ * ring setup parameters of worker id from opts
+ */
+void ring_params(struct io_uring_params *params, int id) {
+    memset(params, 0, sizeof(struct io_uring_params));
+    if (opts.sqpoll) {
+        params->flags = IORING_SETUP_SQPOLL; // enable sqpoll
+        if (opts.nr_sq_cpus) {
+            params->flags |= IORING_SETUP_SQ_AFF; // sqpoll cpu affinity
+            params->sq_thread_cpu = opts.sq_cpus[id % opts.nr_sq_cpus];
+        }
+        params->sq_thread_idle = opts.sq_idle; // idle after sq_idle ms of inactive
+    }
+    if (opts.cq_size) {
+        params->flags |= IORING_SETUP_CQSIZE;
+        params->cq_entries = opts.cq_size;
+    }
+    if (opts.single_issuer) {
+        params->flags |= IORING_SETUP_SINGLE_ISSUER; // only this worker submits
+    }
+    if (opts.defer_taskrun) {
+        params->flags |= IORING_SETUP_DEFER_TASKRUN; // run completion work when we reap
+    }
+    if (opts.iopoll) {
+        // completions are polled from the device, by the sq thread under sqpoll
+        // and by io_uring_enter(GETEVENTS) otherwise. needs O_DIRECT.
+        params->flags |= IORING_SETUP_IOPOLL;
+    }
+}
+
+int setup_ring(struct worker *w) {
+    struct io_uring_params params;
+    ring_params(&params, w->id);
+    if (opts.attach_wq && w->id > 0) {
+        // share worker 0's sq thread (and io-wq) instead of spawning another one
+        int fd = wait_wq();
+        if (fd < 0) {
+            return -1;
+        }
+        params.flags |= IORING_SETUP_ATTACH_WQ;
+        params.wq_fd = fd;
+    }
+
+    int ret = io_uring_queue_init_params(opts.depth, &w->io_uring, &params);
+    if (opts.attach_wq && w->id == 0) {
+        publish_wq(ret ? -1 : w->io_uring.ring_fd);
+    }
+    if (ret) {
+        fprintf(stderr, "worker %d: init_ring failed: %s\n", w->id, strerror(-ret));
+        return ret;
+    }
+    return 0;
+}
+
+/**
+ * the kernel refused a step of the probe ladder, say which one
+ */
+void fall_back(const char *what, int err) {
+    fprintf(stderr, "probe: %s: %s, falling back\n", what, strerror(-err));
+}
+
+/**
+ * create a ring with opts as they are. every refusal drops one option and
+ * tries again: the flags of 6.x kernels, the sq thread's pinning, the sq
+ * thread (unprivileged since 5.11), polled completions, the cq size.
+ * returns -errno once even a plain ring is refused.
+ */
+int probe_ring(struct io_uring *ring) {
+    for (;;) {
+        struct io_uring_params params;
+        ring_params(&params, 0);
+        int ret = io_uring_queue_init_params(opts.depth, ring, &params);
+        if (!ret) {
+            return 0;
+        }
+        if (opts.single_issuer || opts.defer_taskrun) {
+            fall_back("IORING_SETUP_SINGLE_ISSUER / DEFER_TASKRUN", ret);
+            opts.single_issuer = opts.defer_taskrun = 0;
+        } else if (opts.sqpoll && opts.nr_sq_cpus) {
+            fall_back("pinned sq thread", ret);
+            opts.nr_sq_cpus = 0;
+        } else if (opts.sqpoll) {
+            fall_back("IORING_SETUP_SQPOLL", ret);
+            opts.sqpoll = 0;
+        } else if (opts.iopoll) {
+            fall_back("IORING_SETUP_IOPOLL", ret);
+            opts.iopoll = 0;
+        } else if (opts.cq_size) {
+            fall_back("IORING_SETUP_CQSIZE", ret);
+            opts.cq_size = 0;
+        } else {
+            return ret;
+        }
+    }
+}
+
+/**
+ * run the single sqe queued on the probe ring and return its result
+ */
+int probe_sqe(struct io_uring *ring) {
     struct io_uring_cqe *cqe;
-    if (!io_uring_cq_ready(io_uring)) {
-        return 1;
+    int ret = io_uring_submit_and_wait(ring, 1);
+    if (ret >= 0) {
+        ret = io_uring_wait_cqe(ring, &cqe);
     }
-    int ret = io_uring_wait_cqe(io_uring, &cqe);
     if (ret < 0) {
-        fprintf(stderr, "io_uring_wait_cqe: %s\n", strerror(-ret));
         return ret;
     }
-    if (cqe->res < 0) {
-        fprintf(stderr, "cqe res: %s\n", strerror(-cqe->res));
-        return cqe->res;
+    ret = cqe->res;
+    io_uring_cqe_seen(ring, cqe);
+    return ret;
+}
+
+/**
+ * install the first file in slot 0 of the probe ring's file table the way
+ * open_files() will, finding out on the way whether the table can be
+ * sparse and whether OPENAT can open into it. prints why it failed.
+ */
+int probe_open(struct io_uring *ring) {
+    int fd = open(files[0].path, open_flags);
+    if (fd < 0) {
+        fprintf(stderr, "%s: %s\n", files[0].path, strerror(errno));
+        return -errno;
+    }
+    int ret = register_file_table(ring, 1);
+    if (ret && sparse_files) {
+        fall_back("sparse fixed file table", ret);
+        sparse_files = 0;
+        ret = register_file_table(ring, 1);
+    }
+    if (ret) {
+        fprintf(stderr, "register_file_table: %s\n", strerror(-ret));
+        close(fd);
+        return ret;
+    }
+    if (async_open && !opts.iopoll) {
+        io_uring_prep_openat_direct(io_uring_get_sqe(ring), AT_FDCWD, files[0].path, open_flags, 0, 0);
+        ret = probe_sqe(ring);
+        if (!ret) {
+            close(fd);
+            return 0;
+        }
+        if (ret > 0) {
+            // kernels before 5.15 ignore the file index and return a plain descriptor
+            close(ret);
+            ret = -EINVAL;
+        }
+        if (ret != -EINVAL) {
+            fprintf(stderr, "%s: IORING_OP_OPENAT: %s\n", files[0].path, strerror(-ret));
+            close(fd);
+            return ret;
+        }
+        // probe_direct() checked the flags with open(2), so the kernel refused the direct open itself
+        fall_back("IORING_OP_OPENAT into the fixed file table", ret);
+        async_open = 0;
+    }
+    ret = io_uring_register_files_update(ring, 0, &fd, 1);
+    close(fd);
+    if (ret < 0) {
+        fprintf(stderr, "io_uring_register_files_update: %s\n", strerror(-ret));
+        return ret;
     }
-    io_uring_cqe_seen(io_uring, cqe);
     return 0;
 }
 
-int read_block(struct io_uring *io_uring, struct buf_info *buf_info, int fd) {
-    struct io_uring_sqe *sqe;
-    while (1) {
-        while (!io_uring_sq_space_left(io_uring)) {
-            while (io_uring_sq_ready(io_uring)) {
-                check_cqe(io_uring);
+/**
+ * a filesystem without O_DIRECT (tmpfs, some overlays) and a kernel without
+ * direct opens both answer EINVAL, engine_open_file() tells them apart
+ * before the ring is asked. without O_DIRECT the files are read buffered and
+ * polled completions are off, they need O_DIRECT.
+ */
+void probe_direct(void) {
+    size_t size, dio_align;
+    int fd = engine_open_file(files[0].path, &size, &dio_align);
+    if (fd < 0) {
+        return; // probe_open() reports it
+    }
+    close(fd);
+    if (dio_align == 1) {
+        fall_back("O_DIRECT", -EINVAL);
+        open_flags = O_RDONLY;
+        opts.iopoll = 0;
+    }
+}
+
+/**
+ * read the first block of the first file through the probe ring, into a
+ * registered buffer when fixed buffers are on. returns the read's result.
+ */
+int probe_read(struct io_uring *ring) {
+    struct buf_pool pool;
+    if (buf_pool_init(&pool, 1, opts.block_size)) {
+        return -ENOMEM;
+    }
+    int buf_index = -1;
+    if (opts.fixed_buffers) {
+        struct iovec iov = {.iov_base = pool.arena, .iov_len = opts.block_size};
+        int ret = io_uring_register_buffers(ring, &iov, 1);
+        if (ret) {
+            fall_back("registered buffers", ret);
+            opts.fixed_buffers = 0;
+        } else {
+            buf_index = 0;
+        }
+    }
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+    if (buf_index >= 0) {
+        io_uring_prep_read_fixed(sqe, 0, pool.arena, opts.block_size, 0, buf_index);
+    } else {
+        io_uring_prep_read(sqe, 0, pool.arena, opts.block_size, 0);
+    }
+    io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+    int ret = probe_sqe(ring);
+    buf_pool_destroy(&pool);
+    return ret;
+}
+
+/**
+ * pick the fastest configuration this kernel and device support, walking
+ * down from what opts asks for (with --auto: sqpoll + iopoll + fixed
+ * buffers) to a plain ring, and to pread(2) on the worker threads when
+ * io_uring is unusable, e.g. disabled by kernel.io_uring_disabled or a
+ * container's seccomp profile. opts keeps what survived. prints every step
+ * and the path taken. returns 0, or -errno when the files cannot be read.
+ */
+int probe_features(void) {
+    struct io_uring ring;
+    probe_direct();
+    for (;;) {
+        int ret = probe_ring(&ring);
+        if (ret) {
+            fall_back("io_uring", ret);
+            io_path = IO_PATH_PREAD;
+            break;
+        }
+        struct io_uring_probe *probe = io_uring_get_probe_ring(&ring);
+        if (!probe || !io_uring_opcode_supported(probe, IORING_OP_READ)) {
+            // the opcode probe and IORING_OP_READ both came with 5.6
+            fall_back("IORING_OP_READ", -EOPNOTSUPP);
+            io_uring_free_probe(probe);
+            io_uring_queue_exit(&ring);
+            io_path = IO_PATH_PREAD;
+            break;
+        }
+        if (!io_uring_opcode_supported(probe, IORING_OP_OPENAT)) {
+            async_open = 0;
+        }
+        io_uring_free_probe(probe);
+
+        ret = probe_open(&ring);
+        if (ret) {
+            io_uring_queue_exit(&ring);
+            return ret; // probe_open() said why
+        }
+        ret = probe_read(&ring);
+        if (ret >= 0 && opts.pbufs) {
+            struct io_uring_buf_ring *br = io_uring_setup_buf_ring(&ring, 1, PBUF_GROUP, 0, &ret);
+            if (br) {
+                io_uring_free_buf_ring(&ring, br, 1, PBUF_GROUP);
+            } else {
+                fall_back("provided buffer ring", ret);
+                opts.pbufs = 0;
+                ret = 0;
             }
         }
-        struct io_uring_sqe *sqe = io_uring_get_sqe(io_uring);
-        if (!sqe) {
-            fprintf(stderr, "io_uring_get_sqe failed");
+        io_uring_queue_exit(&ring);
+        if (ret == -EOPNOTSUPP && opts.iopoll) {
+            // the ring accepts IOPOLL, the device has no poll queues
+            fall_back("polled reads on this device", ret);
+            opts.iopoll = 0;
             continue;
         }
-        io_uring_prep_read(sqe, fd, buf_info->buf, buf_info->len, buf_info->offset);
-        io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
-        io_uring_sqe_set_data(sqe, buf_info->offset);
-        if (io_uring_sq_space_left(io_uring) == 0) {
-            int submitted = io_uring_submit(io_uring);
+        if (ret < 0) {
+            fprintf(stderr, "%s: %s\n", files[0].path, strerror(-ret));
+            return ret;
         }
         break;
     }
+
+    if (io_path == IO_PATH_PREAD) {
+        opts.sqpoll = opts.iopoll = opts.fixed_buffers = 0;
+        opts.pbufs = 0;
+        fprintf(stderr, "io path: pread(2) on %d worker thread%s\n", opts.threads, opts.threads > 1 ? "s" : "");
+        return 0;
+    }
+    fprintf(stderr, "io path: io_uring%s%s%s%s, %s file table, files opened %s with %s\n", opts.sqpoll ? " + sqpoll" : "",
+            opts.iopoll ? " + iopoll" : "", opts.fixed_buffers ? " + fixed buffers" : "",
+            opts.pbufs ? " + provided buffers" : "", sparse_files ? "sparse" : "-1 filled",
+            open_flags & O_DIRECT ? "O_DIRECT" : "buffered", async_open && !opts.iopoll ? "IORING_OP_OPENAT" : "open(2)");
+    return 0;
 }
 
-int read_file(struct io_uring *io_uring, struct file_info *file_info) {
-    for (int i = 0; i < file_info->blocks; i++) {
-        int buf_index = (i % 2) ? (file_info->blocks - (i / 2) - 1) : i / 2;
-        read_block(io_uring, &file_info->buffers[buf_index], 0);
+/**
+ * pread path: open the files of the shard and take a buffer for one
+ * coalesced run, the worker reads synchronously
+ */
+int prepare_pread(struct worker *w) {
+    w->fds = malloc(nr_files * sizeof(int));
+    w->requests = calloc(1, sizeof(struct buf_info));
+    if (!w->fds || !w->requests || buf_pool_init(&w->pool, 1, opts.block_size * opts.coalesce)) {
+        return -ENOMEM;
+    }
+    w->requests[0].buf = buf_pool_slot(&w->pool, 0);
+    memset(w->fds, -1, nr_files * sizeof(int));
+    if (!w->nr_blocks) {
+        return 0;
     }
-    while (io_uring_sq_ready(io_uring) || io_uring_cq_ready(io_uring)) {
-        check_cqe(io_uring);
+    unsigned first = file_of_block(w->first_block);
+    unsigned last = file_of_block(w->first_block + w->nr_blocks - 1);
+    for (unsigned i = first; i <= last; i++) {
+        // probe_direct() dropped O_DIRECT from open_flags if the filesystem refuses it
+        w->fds[i] = open(files[i].path, open_flags);
+        if (w->fds[i] < 0) {
+            fprintf(stderr, "worker %d: open %s: %s\n", w->id, files[i].path, strerror(errno));
+            return -errno;
+        }
     }
+    return 0;
 }
 
-int register_file(struct io_uring *io_uring, int fd) {
-    return io_uring_register(io_uring->ring_fd, IORING_REGISTER_FILES, &fd, 1);
-}
+/**
+ * worker thread: pin, build the ring and buffers, then read the shard.
+ * the ring is created here so that a single-issuer ring belongs to this thread.
+ */
+void *worker_main(void *arg) {
+    struct worker *w = arg;
 
-struct file_info *prepare_file(char *filename) {
-    int fd = open_file(filename);
-    if (fd < 0) {
+    // cpu affinity
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(w->cpu, &cpuset);
+    sched_setaffinity(0, sizeof(cpuset), &cpuset); // worker thread cpu affinity
+
+    if (io_path == IO_PATH_PREAD) {
+        w->ret = prepare_pread(w);
+        goto ready;
+    }
+    w->ret = setup_ring(w);
+    if (!w->ret) {
+        w->ret = open_files(w);
+    }
+    if (!w->ret && prepare_buffers(w)) {
+        fprintf(stderr, "worker %d: prepare_buffers failed\n", w->id);
+        w->ret = -1;
+    }
+    if (!w->ret && opts.fixed_buffers) {
+        // the probe registered one block, the whole pool may still exceed RLIMIT_MEMLOCK
+        int ret = register_buffers(w);
+        if (ret) {
+            fprintf(stderr, "worker %d: register_buffers: %s%s, reading without fixed buffers\n", w->id,
+                    strerror(-ret), ret == -ENOMEM ? " (check RLIMIT_MEMLOCK)" : "");
+        } else {
+            w->fixed_buffers = 1;
+        }
+    }
+    if (!w->ret && opts.verify) {
+        // the verifier is not pinned, it should run next to the worker, not on its cpu
+        pthread_mutex_init(&w->verify_lock, NULL);
+        pthread_cond_init(&w->verify_cond, NULL);
+        if (spsc_init(&w->to_verify, opts.inflight) || spsc_init(&w->verified, opts.inflight) ||
+            pthread_create(&w->verifier, NULL, verify_main, w)) {
+            fprintf(stderr, "worker %d: cannot start the verifier\n", w->id);
+            w->ret = -1;
+        }
+    }
+ready:
+    hist_init(&w->latency);
+
+    pthread_barrier_wait(&start_barrier);
+    if (w->ret) {
         return NULL;
     }
-    size_t file_size = get_file_size(fd);
-    size_t blocks = file_size / BUF_SIZE + (file_size % BUF_SIZE ? 1 : 0);
-    struct file_info *file_info = malloc(sizeof(struct file_info) + (sizeof(struct buf_info) * blocks));
-    if (!file_info) {
+    uint64_t start = now_ns();
+    w->ret = read_file(w);
+    w->result.elapsed_ns = now_ns() - start;
+    if (io_path == IO_PATH_PREAD) {
+        for (unsigned i = 0; i < nr_files; i++) {
+            if (w->fds[i] >= 0) {
+                close(w->fds[i]);
+            }
+        }
+        free(w->fds);
         return NULL;
     }
-    memset(file_info, 0, sizeof(struct file_info) + (sizeof(struct buf_info) * blocks));
-    file_info->fd = fd;
-    file_info->file_size = file_size;
-    file_info->blocks = blocks;
+    if (opts.verify) {
+        pthread_mutex_lock(&w->verify_lock);
+        __atomic_store_n(&w->verify_stop, 1, __ATOMIC_RELEASE);
+        pthread_cond_signal(&w->verify_cond);
+        pthread_mutex_unlock(&w->verify_lock);
+        pthread_join(w->verifier, NULL);
+        spsc_destroy(&w->to_verify);
+        spsc_destroy(&w->verified);
+    }
+    if (w->buf_ring) {
+        io_uring_free_buf_ring(&w->io_uring, w->buf_ring, opts.pbufs, PBUF_GROUP);
+    }
+    io_uring_queue_exit(&w->io_uring);
+    return NULL;
+}
 
-    // buffer alloc
-    for (int i = 0; i < blocks; i++) {
-        int ret = posix_memalign(&file_info->buffers[i].buf, BUF_SIZE, BUF_SIZE);
-        if (ret != 0) {
-            fprintf(stderr, "posix_memalign: %s\n", strerror(ret));
-            return NULL;
+/**
+ * append a regular file to the file table. empty files are skipped, they
+ * have no blocks to read.
+ */
+int add_file(const char *path, const struct stat *st) {
+    if (!st->st_size) {
+        return 0;
+    }
+    if (!(nr_files & (nr_files - 1))) {
+        struct file_info *grown = realloc(files, sizeof(struct file_info) * (nr_files ? nr_files * 2 : 1));
+        if (!grown) {
+            return -1;
         }
-        file_info->buffers[i].len = (i == blocks - 1 && (file_size % BUF_SIZE) ? (file_size % BUF_SIZE) : BUF_SIZE);
-        file_info->buffers[i].offset = i * BUF_SIZE;
+        files = grown;
     }
+    struct file_info *file = &files[nr_files++];
+    file->path = strdup(path);
+    file->file_size = st->st_size;
+    file->blocks = file->file_size / opts.block_size + (file->file_size % opts.block_size ? 1 : 0);
+    return file->path ? 0 : -1;
+}
 
-    return file_info;
+static int name_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
 }
 
-int main(int argc, char *argv[]) {
+/**
+ * add a file, or the regular files of a directory in name order
+ */
+int add_path(const char *path) {
+    struct stat st;
+    if (stat(path, &st)) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return add_file(path, &st);
+    }
 
-    if (argc < 2) {
-        fprintf(stderr, "usage: %s filename\n", argv[0]);
+    DIR *dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
         return -1;
     }
+    char **names = NULL;
+    size_t nr_names = 0, cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir))) {
+        if (ent->d_name[0] == '.' || crc32c_is_sidecar(ent->d_name)) {
+            continue;
+        }
+        if (nr_names == cap) {
+            cap = cap ? cap * 2 : 64;
+            names = realloc(names, sizeof(char *) * cap);
+            if (!names) {
+                closedir(dir);
+                return -1;
+            }
+        }
+        names[nr_names++] = strdup(ent->d_name);
+    }
+    closedir(dir);
+    qsort(names, nr_names, sizeof(char *), name_cmp);
 
-    struct io_uring io_uring;
-    struct io_uring_params params;
-    memset(&params, 0, sizeof(struct io_uring_params));
-    params.flags = IORING_SETUP_SQPOLL;  // enable sqpoll
-    params.flags |= IORING_SETUP_SQ_AFF; // sqpoll cpu affinity
-    params.sq_thread_cpu = 1;            // set core 1
-    params.sq_thread_idle = 2000;        // idle after 2000ms of inactive
-
-    if (io_uring_queue_init_params(ENTRIES, &io_uring, &params)) {
-        fprintf(stderr, "init_ring failed\n");
+    int ret = 0;
+    for (size_t i = 0; i < nr_names; i++) {
+        char file[PATH_MAX];
+        snprintf(file, sizeof(file), "%s/%s", path, names[i]);
+        if (!ret && !stat(file, &st) && S_ISREG(st.st_mode)) {
+            ret = add_file(file, &st);
+        }
+        free(names[i]);
+    }
+    free(names);
+    return ret;
+}
+
+void print_usage(const char *prog) {
+    fprintf(stderr, "usage: %s [options] file|dir...\n", prog);
+    fprintf(stderr, "files and the regular files of directories are read as one range of blocks\n");
+    fprintf(stderr, "  -q, --depth N      submission queue entries (default %d)\n", ENTRIES);
+    fprintf(stderr, "  -c, --cq-size N    completion queue entries (default 2 x depth)\n");
+    fprintf(stderr, "  -i, --inflight N   maximum requests in flight (default depth)\n");
+    fprintf(stderr, "  -b, --block-size N bytes per read, power of two, k/m suffix (default %d)\n", BUF_SIZE);
+    fprintf(stderr, "  -F, --fixed-buffers register the buffers and read with READ_FIXED\n");
+    fprintf(stderr, "  -C, --coalesce N   merge up to N adjacent blocks into one READV or READ_FIXED (power of two)\n");
+    fprintf(stderr, "  -p, --pattern P    seq, reverse, zigzag (default), random[:seed], zipf[:theta] or stride[:blocks]\n");
+    fprintf(stderr, "  -t, --threads N    worker threads, each with its own ring (default 1)\n");
+    fprintf(stderr, "      --cpus LIST    cpus for the workers, e.g. 0,2,4-7 (default worker i on cpu i)\n");
+    fprintf(stderr, "      --no-sqpoll    submit with io_uring_enter instead of a polling thread\n");
+    fprintf(stderr, "      --single-issuer set IORING_SETUP_SINGLE_ISSUER on every ring\n");
+    fprintf(stderr, "      --defer-taskrun set IORING_SETUP_DEFER_TASKRUN, implies --single-issuer --no-sqpoll\n");
+    fprintf(stderr, "      --iopoll       poll the device for completions instead of waiting for interrupts,\n");
+    fprintf(stderr, "                     needs a driver with poll queues (e.g. nvme.poll_queues=N)\n");
+    fprintf(stderr, "      --attach-wq    rings of workers 1..N-1 share the sq thread of worker 0\n");
+    fprintf(stderr, "      --sq-cpus LIST cpus for the sq threads, ring i on the i-th entry, or \"any\" (default 1)\n");
+    fprintf(stderr, "      --sq-idle MS   sq thread idle time before it sleeps (default 2000)\n");
+    fprintf(stderr, "      --pbuf-ring N  let the kernel pick each read's buffer from a ring of N provided\n");
+    fprintf(stderr, "                     buffers (power of two), so memory no longer scales with -i\n");
+    fprintf(stderr, "      --make-checksums write a crc32c sidecar (file%s) per block of every file and exit\n",
+            CRC32C_SUFFIX);
+    fprintf(stderr, "      --verify       check every block read against its sidecar on a separate thread\n");
+    fprintf(stderr, "      --auto         start from sqpoll + iopoll + fixed buffers and keep what the kernel\n");
+    fprintf(stderr, "                     and device support, down to pread(2) on the worker threads\n");
+    fprintf(stderr, "  -f, --format FMT   result format: text, csv or json\n");
+}
+
+enum {
+    OPT_CPUS = 256,
+    OPT_NO_SQPOLL,
+    OPT_SINGLE_ISSUER,
+    OPT_DEFER_TASKRUN,
+    OPT_IOPOLL,
+    OPT_ATTACH_WQ,
+    OPT_SQ_CPUS,
+    OPT_SQ_IDLE,
+    OPT_PBUF_RING,
+    OPT_MAKE_CHECKSUMS,
+    OPT_VERIFY,
+    OPT_AUTO,
+};
+
+int parse_options(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        {"depth", required_argument, NULL, 'q'},
+        {"cq-size", required_argument, NULL, 'c'},
+        {"inflight", required_argument, NULL, 'i'},
+        {"block-size", required_argument, NULL, 'b'},
+        {"fixed-buffers", no_argument, NULL, 'F'},
+        {"threads", required_argument, NULL, 't'},
+        {"pattern", required_argument, NULL, 'p'},
+        {"coalesce", required_argument, NULL, 'C'},
+        {"cpus", required_argument, NULL, OPT_CPUS},
+        {"no-sqpoll", no_argument, NULL, OPT_NO_SQPOLL},
+        {"single-issuer", no_argument, NULL, OPT_SINGLE_ISSUER},
+        {"defer-taskrun", no_argument, NULL, OPT_DEFER_TASKRUN},
+        {"iopoll", no_argument, NULL, OPT_IOPOLL},
+        {"attach-wq", no_argument, NULL, OPT_ATTACH_WQ},
+        {"sq-cpus", required_argument, NULL, OPT_SQ_CPUS},
+        {"sq-idle", required_argument, NULL, OPT_SQ_IDLE},
+        {"pbuf-ring", required_argument, NULL, OPT_PBUF_RING},
+        {"make-checksums", no_argument, NULL, OPT_MAKE_CHECKSUMS},
+        {"verify", no_argument, NULL, OPT_VERIFY},
+        {"auto", no_argument, NULL, OPT_AUTO},
+        {"format", required_argument, NULL, 'f'},
+        {NULL, 0, NULL, 0},
+    };
+    parse_pattern("zigzag", &opts.pattern);
+    int opt;
+    while ((opt = getopt_long(argc, argv, "q:c:i:b:FC:t:p:f:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'q':
+            opts.depth = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            opts.cq_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            opts.inflight = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            opts.block_size = parse_size(optarg);
+            if (!valid_block_size(opts.block_size)) {
+                fprintf(stderr, "block size must be a power of two between %d and %d\n", MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+                return -1;
+            }
+            break;
+        case 'F':
+            opts.fixed_buffers = 1;
+            break;
+        case 't':
+            opts.threads = atoi(optarg);
+            if (opts.threads < 1 || opts.threads > MAX_THREADS) {
+                fprintf(stderr, "threads must be between 1 and %d\n", MAX_THREADS);
+                return -1;
+            }
+            break;
+        case 'C':
+            // powers of two keep every slot inside one registered buffer
+            opts.coalesce = strtoul(optarg, NULL, 0);
+            if (!opts.coalesce || opts.coalesce > MAX_COALESCE || (opts.coalesce & (opts.coalesce - 1))) {
+                fprintf(stderr, "coalesce must be a power of two between 1 and %d\n", MAX_COALESCE);
+                return -1;
+            }
+            break;
+        case 'p':
+            if (parse_pattern(optarg, &opts.pattern)) {
+                fprintf(stderr, "unknown pattern: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_CPUS:
+            opts.nr_cpus = parse_cpu_list(optarg, opts.cpus, MAX_THREADS);
+            if (opts.nr_cpus <= 0) {
+                fprintf(stderr, "invalid cpu list: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_NO_SQPOLL:
+            opts.sqpoll = 0;
+            break;
+        case OPT_IOPOLL:
+            opts.iopoll = 1;
+            break;
+        case OPT_ATTACH_WQ:
+            opts.attach_wq = 1;
+            break;
+        case OPT_SQ_CPUS:
+            if (!strcmp(optarg, "any")) {
+                opts.nr_sq_cpus = 0;
+                break;
+            }
+            opts.nr_sq_cpus = parse_cpu_list(optarg, opts.sq_cpus, MAX_THREADS);
+            if (opts.nr_sq_cpus <= 0) {
+                fprintf(stderr, "invalid cpu list: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_SQ_IDLE:
+            opts.sq_idle = atoi(optarg);
+            break;
+        case OPT_MAKE_CHECKSUMS:
+            opts.make_checksums = 1;
+            break;
+        case OPT_VERIFY:
+            opts.verify = 1;
+            break;
+        case OPT_AUTO:
+            opts.auto_tune = 1;
+            break;
+        case OPT_PBUF_RING:
+            opts.pbufs = strtoul(optarg, NULL, 0);
+            if (!opts.pbufs || opts.pbufs > MAX_PBUFS || (opts.pbufs & (opts.pbufs - 1))) {
+                fprintf(stderr, "provided buffer ring size must be a power of two between 1 and %d\n", MAX_PBUFS);
+                return -1;
+            }
+            break;
+        case OPT_SINGLE_ISSUER:
+            opts.single_issuer = 1;
+            break;
+        case OPT_DEFER_TASKRUN:
+            // the kernel requires a single issuer and refuses it with sqpoll
+            opts.defer_taskrun = 1;
+            opts.single_issuer = 1;
+            opts.sqpoll = 0;
+            break;
+        case 'f':
+            opts.format = parse_report_format(optarg);
+            if (opts.format < 0) {
+                fprintf(stderr, "unknown format: %s\n", optarg);
+                return -1;
+            }
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (optind >= argc || !opts.depth) {
         return -1;
     }
+    if (!opts.inflight) {
+        opts.inflight = opts.depth;
+    }
+    if (opts.auto_tune) {
+        // the fastest combination, probe_features() drops what is refused
+        opts.iopoll = 1;
+        if (!opts.pbufs && opts.block_size * opts.coalesce <= MAX_FIXED_BUF_SIZE) {
+            opts.fixed_buffers = 1;
+        }
+    }
+    // a selected buffer holds one block and cannot back a vectored or fixed read
+    if (opts.pbufs && (opts.fixed_buffers || opts.coalesce > 1)) {
+        fprintf(stderr, "--pbuf-ring cannot be combined with --fixed-buffers or --coalesce\n");
+        return -1;
+    }
+    if (opts.fixed_buffers && opts.block_size * opts.coalesce > MAX_FIXED_BUF_SIZE) {
+        fprintf(stderr, "a coalesced read must fit in one registered buffer of %lu bytes\n", MAX_FIXED_BUF_SIZE);
+        return -1;
+    }
+    // every in-flight request needs a cq slot, otherwise completions overflow
+    if (!opts.cq_size && opts.inflight > opts.depth * 2) {
+        opts.cq_size = opts.inflight;
+    }
+    if (opts.cq_size && opts.cq_size < opts.inflight) {
+        fprintf(stderr, "warning: cq size %u is smaller than in-flight limit %u\n", opts.cq_size, opts.inflight);
+    }
+    return 0;
+}
 
-    // cpu affinity
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    CPU_SET(0, &cpuset);
-    sched_setaffinity(0, sizeof(cpuset), &cpuset); // main process cpu affinity
+int main(int argc, char *argv[]) {
+    if (parse_options(argc, argv)) {
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    for (int i = optind; i < argc; i++) {
+        if (add_path(argv[i])) {
+            return -1;
+        }
+    }
+    if (!nr_files) {
+        fprintf(stderr, "no non-empty files to read\n");
+        return -1;
+    }
+    for (unsigned i = 0; i < nr_files; i++) {
+        files[i].first_block = total_blocks;
+        total_blocks += files[i].blocks;
+    }
+
+    if (opts.make_checksums || opts.verify) {
+        crc32c_init();
+    }
+    if (opts.make_checksums) {
+        for (unsigned i = 0; i < nr_files; i++) {
+            int ret = crc32c_make_sidecar(files[i].path, opts.block_size);
+            if (ret) {
+                fprintf(stderr, "%s: cannot write checksums: %s\n", files[i].path, strerror(-ret));
+                return -1;
+            }
+        }
+        printf("wrote crc32c sidecars of %u files, %zu blocks of %zu bytes\n", nr_files, total_blocks,
+               opts.block_size);
+        return 0;
+    }
+    if (opts.verify) {
+        checksums = malloc(total_blocks * sizeof(uint32_t));
+        if (!checksums) {
+            return -1;
+        }
+        for (unsigned i = 0; i < nr_files; i++) {
+            int ret = crc32c_load_sidecar(files[i].path, opts.block_size, files[i].file_size,
+                                          &checksums[files[i].first_block], files[i].blocks);
+            if (ret) {
+                fprintf(stderr, "%s: no usable checksums: %s, run with --make-checksums -b %zu first\n",
+                        files[i].path, strerror(-ret), opts.block_size);
+                return -1;
+            }
+        }
+    }
 
-    struct file_info *file_info = prepare_file(argv[1]);
+    if (probe_features()) {
+        return -1;
+    }
+    const char *engine = io_path == IO_PATH_PREAD ? "io_uring_sqpoll/pread" : "io_uring_sqpoll";
 
-    if (register_file(&io_uring, file_info->fd)) {
-        fprintf(stderr, "register_file failed\n");
+    // split the blocks into contiguous shards, one per worker
+    struct worker *workers = calloc(opts.threads, sizeof(struct worker));
+    if (!workers) {
         return -1;
     }
+    pthread_barrier_init(&start_barrier, NULL, opts.threads + 1);
+    for (int i = 0; i < opts.threads; i++) {
+        struct worker *w = &workers[i];
+        w->id = i;
+        w->cpu = opts.nr_cpus ? opts.cpus[i % opts.nr_cpus] : i;
+        w->first_block = total_blocks * i / opts.threads;
+        w->nr_blocks = total_blocks * (i + 1) / opts.threads - w->first_block;
+        w->pattern = opts.pattern;
+        pattern_init(&w->pattern, w->nr_blocks, i);
+        w->result.engine = engine;
+        w->result.block_size = opts.block_size;
+        if (pthread_create(&w->thread, NULL, worker_main, w)) {
+            perror("pthread_create: ");
+            return -1;
+        }
+    }
 
-    printf("start read\n");
-    read_file(&io_uring, file_info);
-    printf("read to buffer done\n");
-    io_uring_queue_exit(&io_uring);
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start = now_ns();
+    for (int i = 0; i < opts.threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
 
-    return 0;
-}
\ No newline at end of file
+    // aggregate the shards
+    struct bench_result result = {.engine = engine, .block_size = opts.block_size};
+    result.elapsed_ns = now_ns() - start;
+    struct histogram latency;
+    hist_init(&latency);
+    size_t sq_wakeups = 0, cq_overflows = 0, cq_dropped = 0, sqes_saved = 0, enobufs = 0;
+    size_t blocks_verified = 0, mismatches = 0;
+    size_t short_reads = 0, retried = 0, failed_reads = 0;
+    int failed = 0;
+    for (int i = 0; i < opts.threads; i++) {
+        struct worker *w = &workers[i];
+        if (w->ret) {
+            failed = 1;
+        }
+        result.bytes += w->result.bytes;
+        result.ops += w->result.ops;
+        sq_wakeups += w->sq_wakeups;
+        sqes_saved += w->sqes_saved;
+        cq_overflows += w->cq_overflows;
+        cq_dropped += w->cq_dropped;
+        enobufs += w->enobufs;
+        blocks_verified += w->blocks_verified;
+        mismatches += w->mismatches;
+        short_reads += w->short_reads;
+        retried += w->retried;
+        failed_reads += w->failed;
+        hist_merge(&latency, &w->latency);
+        if (opts.threads > 1 && opts.format == REPORT_TEXT) {
+            double secs = w->result.elapsed_ns / 1e9;
+            printf("worker %d (cpu %d): %zu bytes, %.2f MB/s\n", w->id, w->cpu, w->result.bytes,
+                   secs > 0 ? w->result.bytes / (1024.0 * 1024.0) / secs : 0);
+        }
+        buf_pool_destroy(&w->pool);
+        if (w->requests) {
+            free(w->requests[0].iov);
+        }
+        free(w->requests);
+    }
+
+    bench_fill_latency(&result, &latency);
+    report_result(stdout, opts.format, &result);
+    if (opts.format == REPORT_TEXT) {
+        hist_print(stdout, &latency);
+    }
+    // frequent wakeups mean sq_idle is too short for the submission rate
+    if (io_path == IO_PATH_RING) {
+        fprintf(opts.format == REPORT_TEXT ? stdout : stderr,
+                "  sq wakeups %zu, cq overflow seen %zu, cqes dropped %zu\n", sq_wakeups, cq_overflows, cq_dropped);
+    }
+    fprintf(opts.format == REPORT_TEXT ? stdout : stderr,
+            "  short reads continued %zu, eagain/eintr retries %zu, failed reads %zu\n", short_reads, retried,
+            failed_reads);
+    if (failed_reads) {
+        failed = 1;
+    }
+    if (opts.coalesce > 1) {
+        fprintf(opts.format == REPORT_TEXT ? stdout : stderr, "  coalescing saved %zu of %zu sqes\n", sqes_saved,
+                result.ops);
+    }
+    if (opts.pbufs) {
+        // many retries mean the ring is too small for the in-flight limit
+        fprintf(opts.format == REPORT_TEXT ? stdout : stderr,
+                "  provided buffers %u per worker (%zu bytes), reads retried on ENOBUFS %zu\n", opts.pbufs,
+                opts.pbufs * opts.block_size, enobufs);
+    }
+    if (opts.verify) {
+        fprintf(opts.format == REPORT_TEXT ? stdout : stderr, "  verified %zu blocks, %zu checksum mismatches\n",
+                blocks_verified, mismatches);
+        if (mismatches) {
+            failed = 1;
+        }
+    }
+    free(workers);
+    free(checksums);
+
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,371 @@
+/**
+ * write-ahead log program using liburing: sequential O_DIRECT writes with a
+ * IORING_OP_FSYNC (IORING_FSYNC_DATASYNC) committing every group of
+ * sync_every blocks.
+ *
+ * in link mode the writes of a group and its fsync form one IOSQE_IO_LINK
+ * chain, so groups commit independently of each other. in drain mode the
+ * writes of a group run in parallel and the fsync carries IOSQE_IO_DRAIN,
+ * which holds it, and everything queued after it, until all earlier
+ * requests completed.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <liburing.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "buf_pool.h"
+
+#define BUF_SIZE 4096            // default block size
+#define LOG_SIZE (64ul << 20)    // default bytes written
+#define ENTRIES 32               // default submission queue depth
+#define REAP_BATCH 256           // completions handled per peek
+#define MAX_FIXED_BUF_SIZE (1ul << 30) // kernel limit for one registered buffer
+#define USAGE                                                                                                    \
+    "usage: %s [-q depth] [-i inflight] [-b block_size] [-s size] [-S sync_every] [-m link|drain] [-F] "        \
+    "[-f text|csv|json] filename\n"
+
+enum sync_mode {
+    SYNC_LINK,  // writes -> fsync as one linked chain per group
+    SYNC_DRAIN, // parallel writes, fsync with IOSQE_IO_DRAIN
+};
+
+/**
+ * one in-flight write or fsync. the sqe user_data points here.
+ */
+struct write_req {
+    off_t offset;       // fd offset
+    size_t len;         // buffer length
+    char *buf;          // buffer
+    unsigned slot;      // buffer pool slot
+    unsigned buf_index; // registered buffer holding the slot, with -F
+    uint64_t submit_ns; // submission timestamp
+    uint64_t group_ns;  // submission of the first write of the group
+    int holds_slot;     // the group's fsync releases the slot, not the write
+    void (*complete)(struct write_req *req, int res); // completion handler
+};
+
+static struct histogram latency; // commit latency, or write latency without syncs
+static struct bench_result result = {.engine = "io_uring_write"};
+static unsigned inflight; // submitted but not yet completed sqes
+
+static unsigned depth = ENTRIES;  // submission queue entries
+static unsigned max_inflight;     // maximum writes in flight
+static size_t block_size = BUF_SIZE;
+static unsigned sync_every = 1;   // blocks per fsync, 0 never syncs
+static int sync_mode = SYNC_LINK;
+static int fixed_buffers;         // register the pool and use IORING_OP_WRITE_FIXED
+
+static struct buf_pool pool;       // one buffer per in-flight write
+static struct write_req *requests; // write state per pool slot
+static struct write_req *syncs;    // fsync state, keyed by the slot of the group's last write
+
+static size_t fsyncs;        // completed fsyncs
+static size_t cancelled;     // requests cancelled by a failed link
+static size_t failed_writes; // writes that failed or came back short
+static size_t failed_syncs;  // fsyncs that failed, their group is not durable
+
+void write_done(struct write_req *req, int res) {
+    inflight--;
+    if (!req->holds_slot) {
+        buf_pool_put(&pool, req->slot);
+    }
+    if (!sync_every) {
+        hist_record(&latency, hist_now_ns() - req->submit_ns);
+    }
+    if (res == -ECANCELED) {
+        cancelled++;
+        return;
+    }
+    if (res < 0) {
+        fprintf(stderr, "write: %s at offset %ld\n", strerror(-res), req->offset);
+        failed_writes++;
+        return;
+    }
+    result.bytes += res;
+    if (res < req->len) {
+        // O_DIRECT into preallocated blocks does not come back short on a healthy device
+        fprintf(stderr, "write: %d of %zu bytes at offset %ld\n", res, req->len, req->offset);
+        failed_writes++;
+        return;
+    }
+    result.ops++;
+}
+
+void sync_done(struct write_req *req, int res) {
+    inflight--;
+    buf_pool_put(&pool, req->slot);
+    hist_record(&latency, hist_now_ns() - req->group_ns);
+    if (res == -ECANCELED) {
+        cancelled++;
+        return;
+    }
+    if (res < 0) {
+        fprintf(stderr, "fsync: %s\n", strerror(-res));
+        failed_syncs++;
+        return;
+    }
+    fsyncs++;
+}
+
+/**
+ * reap completions until at most max sqes are outstanding
+ */
+void check_cqe(struct io_uring *ring, unsigned max) {
+    struct io_uring_cqe *cqes[REAP_BATCH];
+    while (inflight > max) {
+        if (!io_uring_cq_ready(ring)) {
+            int ret = io_uring_wait_cqe(ring, &cqes[0]);
+            if (ret < 0) {
+                fprintf(stderr, "io_uring_wait_cqe: %s\n", strerror(-ret));
+                return;
+            }
+        }
+        unsigned nr = io_uring_peek_batch_cqe(ring, cqes, REAP_BATCH);
+        for (unsigned i = 0; i < nr; i++) {
+            struct write_req *req = io_uring_cqe_get_data(cqes[i]);
+            req->complete(req, cqes[i]->res);
+        }
+        io_uring_cq_advance(ring, nr);
+    }
+}
+
+/**
+ * queue the writes of blocks [first, first + nr) and, if sync is set, the
+ * fsync that commits them
+ */
+int queue_group(struct io_uring *ring, size_t first, unsigned nr, int sync) {
+    unsigned sqes = nr + (sync ? 1 : 0);
+    // every write of the group needs a buffer up front
+    while (pool.nr_free < nr) {
+        io_uring_submit(ring);
+        check_cqe(ring, inflight - 1);
+    }
+    // a chain cut by the end of a submission is not continued by the next one
+    if (io_uring_sq_space_left(ring) < sqes) {
+        io_uring_submit(ring);
+    }
+    uint64_t group_ns = hist_now_ns();
+    struct write_req *req = NULL;
+    for (unsigned i = 0; i < nr; i++) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+        req = &requests[buf_pool_get(&pool)];
+        req->offset = (off_t)(first + i) * block_size;
+        req->len = block_size;
+        req->holds_slot = sync && i == nr - 1;
+        req->complete = write_done;
+        if (fixed_buffers) {
+            io_uring_prep_write_fixed(sqe, 0, req->buf, req->len, req->offset, req->buf_index);
+        } else {
+            io_uring_prep_write(sqe, 0, req->buf, req->len, req->offset);
+        }
+        io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE | (sync && sync_mode == SYNC_LINK ? IOSQE_IO_LINK : 0));
+        io_uring_sqe_set_data(sqe, req);
+        req->submit_ns = req->group_ns = group_ns;
+        inflight++;
+    }
+    if (sync) {
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+        struct write_req *sync_req = &syncs[req->slot];
+        sync_req->slot = req->slot;
+        sync_req->group_ns = group_ns;
+        sync_req->complete = sync_done;
+        io_uring_prep_fsync(sqe, 0, IORING_FSYNC_DATASYNC);
+        io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE | (sync_mode == SYNC_DRAIN ? IOSQE_IO_DRAIN : 0));
+        io_uring_sqe_set_data(sqe, sync_req);
+        inflight++;
+    }
+    if (io_uring_sq_space_left(ring) < sqes) {
+        io_uring_submit(ring);
+    }
+    return 0;
+}
+
+/**
+ * register the buffer pool for IORING_OP_WRITE_FIXED. the arena is split
+ * into 1 GiB iovecs, the per-buffer maximum; slots are powers of two of at
+ * most 1 GiB, so none straddles two iovecs.
+ */
+int register_buffers(struct io_uring *ring) {
+    unsigned nr_iovecs = (pool.arena_size + MAX_FIXED_BUF_SIZE - 1) / MAX_FIXED_BUF_SIZE;
+    struct iovec *iovecs = calloc(nr_iovecs, sizeof(struct iovec));
+    if (!iovecs) {
+        return -ENOMEM;
+    }
+    for (unsigned i = 0; i < nr_iovecs; i++) {
+        size_t offset = i * MAX_FIXED_BUF_SIZE;
+        iovecs[i].iov_base = pool.arena + offset;
+        iovecs[i].iov_len = pool.arena_size - offset < MAX_FIXED_BUF_SIZE ? pool.arena_size - offset : MAX_FIXED_BUF_SIZE;
+    }
+    int ret = io_uring_register_buffers(ring, iovecs, nr_iovecs);
+    free(iovecs);
+    if (ret) {
+        return ret;
+    }
+    for (unsigned i = 0; i < max_inflight; i++) {
+        requests[i].buf_index = (requests[i].buf - pool.arena) / MAX_FIXED_BUF_SIZE;
+    }
+    return 0;
+}
+
+int write_log(struct io_uring *ring, char *filename, size_t size) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_DIRECT, 0644);
+    if (fd < 0) {
+        perror("open: ");
+        return -errno;
+    }
+    size_t blocks = size / block_size + (size % block_size ? 1 : 0);
+    // logs are preallocated, so the timed writes overwrite allocated blocks
+    int ret = posix_fallocate(fd, 0, blocks * block_size);
+    if (ret) {
+        fprintf(stderr, "posix_fallocate: %s\n", strerror(ret));
+        return -ret;
+    }
+    if (fdatasync(fd)) {
+        perror("fdatasync: ");
+        return -errno;
+    }
+
+    if (buf_pool_init(&pool, max_inflight, block_size)) {
+        return -1;
+    }
+    memset(pool.arena, 0xa5, pool.arena_size);
+    requests = calloc(max_inflight, sizeof(struct write_req));
+    syncs = calloc(max_inflight, sizeof(struct write_req));
+    for (unsigned i = 0; i < max_inflight; i++) {
+        requests[i].slot = i;
+        requests[i].buf = buf_pool_slot(&pool, i);
+    }
+
+    ret = io_uring_register_files(ring, &fd, 1);
+    if (ret) {
+        fprintf(stderr, "io_uring_register_files: %s\n", strerror(-ret));
+        return ret;
+    }
+    if (fixed_buffers) {
+        ret = register_buffers(ring);
+        if (ret) {
+            fprintf(stderr, "io_uring_register_buffers: %s%s\n", strerror(-ret),
+                    ret == -ENOMEM ? " (check RLIMIT_MEMLOCK)" : "");
+            return ret;
+        }
+    }
+
+    hist_init(&latency);
+    unsigned group = sync_every ? sync_every : 1;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < blocks; i += group) {
+        unsigned nr = blocks - i < group ? blocks - i : group;
+        if (queue_group(ring, i, nr, sync_every != 0)) {
+            return -1;
+        }
+    }
+    io_uring_submit(ring);
+    check_cqe(ring, 0);
+    result.elapsed_ns = now_ns() - start;
+    close(fd);
+    buf_pool_destroy(&pool);
+    free(requests);
+    free(syncs);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int format = REPORT_TEXT;
+    size_t size = LOG_SIZE;
+    int opt;
+    while ((opt = getopt(argc, argv, "q:i:b:s:S:m:Ff:")) != -1) {
+        switch (opt) {
+        case 'q':
+            depth = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            max_inflight = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            block_size = parse_size(optarg);
+            if (!valid_block_size(block_size)) {
+                fprintf(stderr, "block size must be a power of two between %d and %d\n", MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+                return -1;
+            }
+            break;
+        case 's':
+            size = parse_size(optarg);
+            break;
+        case 'S':
+            sync_every = strtoul(optarg, NULL, 0);
+            break;
+        case 'm':
+            if (!strcmp(optarg, "link")) {
+                sync_mode = SYNC_LINK;
+            } else if (!strcmp(optarg, "drain")) {
+                sync_mode = SYNC_DRAIN;
+            } else {
+                fprintf(stderr, "unknown sync mode: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'F':
+            fixed_buffers = 1;
+            break;
+        case 'f':
+            format = parse_report_format(optarg);
+            if (format < 0) {
+                fprintf(stderr, "unknown format: %s\n", optarg);
+                return -1;
+            }
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            return -1;
+        }
+    }
+    if (optind >= argc || !depth || !size) {
+        fprintf(stderr, USAGE, argv[0]);
+        return -1;
+    }
+    if (!max_inflight) {
+        max_inflight = depth;
+    }
+    // a group and its fsync are queued in one submission
+    if (sync_every > max_inflight || sync_every + 1 > depth) {
+        fprintf(stderr, "a group of %u writes needs an in-flight limit of %u and a queue depth of %u\n", sync_every,
+                sync_every, sync_every + 1);
+        return -1;
+    }
+
+    struct io_uring ring;
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if (max_inflight > depth) {
+        params.flags |= IORING_SETUP_CQSIZE;
+        params.cq_entries = max_inflight * 2; // a cq slot per write and fsync in flight
+    }
+    int ret = io_uring_queue_init_params(depth, &ring, &params);
+    if (ret) {
+        fprintf(stderr, "Unable to setup io_uring: %s\n", strerror(-ret));
+        return -ret;
+    }
+    result.block_size = block_size;
+    ret = write_log(&ring, argv[optind], size);
+    io_uring_queue_exit(&ring);
+
+    bench_fill_latency(&result, &latency);
+    report_result(stdout, format, &result);
+    if (format == REPORT_TEXT) {
+        hist_print(stdout, &latency);
+    }
+    fprintf(format == REPORT_TEXT ? stdout : stderr, "  fsyncs %zu, cancelled %zu, failed writes %zu, failed fsyncs %zu\n",
+            fsyncs, cancelled, failed_writes, failed_syncs);
+    // a cancelled request belongs to a group whose write or fsync failed
+    return ret || failed_writes || failed_syncs || cancelled ? -1 : 0;
+}
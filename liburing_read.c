@@ -4,7 +4,7 @@
 
 #define _GNU_SOURCE
 
-#include <fcntl.h>
+#include <errno.h>
 #include <liburing.h>
 #include <sched.h>
 #include <stdio.h>
@@ -13,102 +13,438 @@
 #include <sys/sysinfo.h>
 #include <unistd.h>
 
-#define BUF_SIZE 4096
-#define FILE_NAME "1G.bin"
-#define FILE_SIZE 1073741824
+#include "bench.h"
+#include "buf_pool.h"
+#include "engine/engine.h"
+#include "pattern.h"
+
+#define BUF_SIZE 4096 // default block size
+#define ENTRIES 8 // default submission queue depth
+#define REAP_BATCH 256 // completions handled per peek
+#define MAX_CHAIN 64   // reads per linked chain
+#define MAX_RETRIES 8  // -EAGAIN / -EINTR retries of one read before it fails
+#define RETRY_BACKOFF_NS 50000 // first retry delay, doubled on every further retry
+#define USAGE                                                                                                          \
+    "usage %s [-q depth] [-c cq_size] [-i inflight] [-b block_size] [-p pattern] [-L chain_len [-H]] [-T timeout_ms] " \
+    "[-f text|csv|json] filename\n"
 
 struct buf_info {
-    off_t offset;
-    size_t len;
+    off_t offset;       // block offset
+    size_t len;         // bytes the block holds, less than block_size for the tail
     char *buf;
+    size_t done;        // bytes of the block read so far
+    size_t pos;         // block offset of the outstanding read, done rounded down to dio_align
+    unsigned retries;   // -EAGAIN / -EINTR retries so far
+    struct __kernel_timespec backoff; // delay before the retry, zero for none
+    struct buf_info *next; // retry list link
+    unsigned slot;      // buffer pool slot
+    uint64_t submit_ns; // submission timestamp
+    void (*complete)(struct buf_info *buf_info, int res); // completion handler
 };
 
-int zigzag_offset(int n, int total) {
-    int offset = n / 2 * BUF_SIZE;
-    if (n & 1) {
-        offset = total - offset - BUF_SIZE;
+static struct histogram latency;
+static struct bench_result result = {.engine = "liburing_read"};
+static unsigned inflight; // submitted but not yet completed requests
+
+static unsigned depth = ENTRIES; // submission queue entries
+static unsigned cq_size;         // completion queue entries, 0 for the kernel default
+static unsigned max_inflight;    // maximum requests in flight
+static size_t block_size = BUF_SIZE;
+static size_t file_size;
+static size_t dio_align = 1; // offset and length alignment of the file's reads, 1 when buffered
+
+static struct buf_pool pool;       // one buffer per in-flight request
+static struct buf_info *requests;  // request state per pool slot
+static struct buf_info *backoffs;  // user_data of each request's backoff timeout, same slot
+static struct pattern pattern;     // block access order
+
+static unsigned chain_len = 1;              // reads per linked chain
+static unsigned link_flag = IOSQE_IO_LINK;  // IOSQE_IO_LINK or IOSQE_IO_HARDLINK
+static struct __kernel_timespec link_timeout; // per-read deadline, zero for none
+
+static size_t chains;         // chains of more than one read queued
+static size_t cancelled;      // reads cancelled by a broken chain or their timeout, and resubmitted
+static size_t timeouts_fired; // linked timeouts that expired
+
+static struct buf_info *retries; // reads to queue again once the current cqe batch is handled
+static size_t short_reads;       // reads that returned less than asked and were continued
+static size_t retried;           // reads retried after -EAGAIN or -EINTR
+static size_t failed;            // reads given up on, their bytes are missing from the result
+static int etime_success;        // timeouts take IORING_TIMEOUT_ETIME_SUCCESS, 5.16
+
+static size_t align_up(size_t n) {
+    return (n + dio_align - 1) / dio_align * dio_align;
+}
+
+/**
+ * the read of a block is over, successful or not
+ */
+void finish_read(struct buf_info *buf_info) {
+    hist_record(&latency, hist_now_ns() - buf_info->submit_ns);
+    buf_pool_put(&pool, buf_info->slot);
+    inflight--;
+}
+
+/**
+ * queue the rest of a block again after the current cqe batch. with O_DIRECT
+ * the continuation has to start aligned, so an unaligned short read is
+ * continued from the alignment boundary below it.
+ */
+void queue_retry(struct buf_info *buf_info) {
+    buf_info->pos = buf_info->done / dio_align * dio_align;
+    buf_info->next = retries;
+    retries = buf_info;
+}
+
+/**
+ * completion handler of a block read. only bytes that were really read
+ * count, a block counts as one op once all of it arrived.
+ */
+void read_done(struct buf_info *buf_info, int res) {
+    if ((res == -EAGAIN || res == -EINTR) && buf_info->retries < MAX_RETRIES) {
+        // transient, try again after an exponentially growing pause
+        uint64_t ns = (uint64_t)RETRY_BACKOFF_NS << buf_info->retries++;
+        buf_info->backoff.tv_sec = ns / 1000000000;
+        buf_info->backoff.tv_nsec = ns % 1000000000;
+        retried++;
+        queue_retry(buf_info);
+        return;
     }
-    return offset;
+    if (res == -ECANCELED) {
+        // an earlier read of the chain failed, or the deadline passed: read the block on its own
+        cancelled++;
+        if (buf_info->retries < MAX_RETRIES) {
+            buf_info->retries++;
+            buf_info->backoff.tv_sec = buf_info->backoff.tv_nsec = 0;
+            queue_retry(buf_info);
+            return;
+        }
+        fprintf(stderr, "read: cancelled %u times at offset %ld, giving up\n", buf_info->retries + 1,
+                buf_info->offset + buf_info->pos);
+        failed++;
+    } else if (res < 0) {
+        fprintf(stderr, "read: %s at offset %ld\n", strerror(-res), buf_info->offset + buf_info->pos);
+        failed++;
+    } else if (buf_info->pos + res <= buf_info->done) {
+        // nothing new, a continuation may only re-read the unaligned end of the previous part
+        fprintf(stderr, "read: unexpected EOF at offset %ld, the file shrank\n", buf_info->offset + buf_info->done);
+        failed++;
+    } else {
+        result.bytes += buf_info->pos + res - buf_info->done;
+        buf_info->done = buf_info->pos + res;
+        if (buf_info->done < buf_info->len) {
+            short_reads++;
+            buf_info->backoff.tv_sec = buf_info->backoff.tv_nsec = 0;
+            queue_retry(buf_info);
+            return;
+        }
+        result.ops++;
+    }
+    finish_read(buf_info);
 }
 
-void check_cqe(struct io_uring *ring) {
-    struct io_uring_cqe *cqe;
-    while (io_uring_sq_ready(ring)) {
-        int ret = io_uring_wait_cqe(ring, &cqe);
-        if (ret < 0) {
-            fprintf(stderr, "Error waiting for completion: %s\n", strerror(-ret));
-            // return ret;
+/**
+ * completion handler of a linked timeout. -ETIME means the deadline passed
+ * and the read was cancelled, -ECANCELED that the read finished in time.
+ */
+void timeout_done(struct buf_info *buf_info, int res) {
+    inflight--;
+    if (res == -ETIME) {
+        timeouts_fired++;
+    }
+}
+
+static struct buf_info timeout_req = {.complete = timeout_done}; // user_data of every linked timeout
+
+/**
+ * completion handler of a retry's backoff timeout. with
+ * IORING_TIMEOUT_ETIME_SUCCESS the timeout is linked and expiring starts the
+ * read behind it. older kernels fail the link on -ETIME, there the read is
+ * queued from here once the timeout fired.
+ */
+void backoff_done(struct buf_info *backoff, int res) {
+    inflight--;
+    if (!etime_success) {
+        struct buf_info *buf_info = &requests[backoff->slot];
+        buf_info->backoff.tv_sec = buf_info->backoff.tv_nsec = 0;
+        queue_retry(buf_info);
+    }
+}
+
+/**
+ * queue the reads on the retry list: the rest of short reads right away,
+ * -EAGAIN / -EINTR retries behind a timeout that delays them in the kernel
+ */
+void queue_retries(struct io_uring *ring) {
+    while (retries) {
+        struct buf_info *buf_info = retries;
+        if (io_uring_sq_space_left(ring) < 2) {
+            io_uring_submit(ring);
         }
-        if (cqe->res < 0) {
-            fprintf(stderr, "Error in async operation: %s at offset %d\n", strerror(-cqe->res), ((struct buf_info *)cqe->user_data)->offset);
-            // return ret;
+        struct io_uring_sqe *sqe;
+        retries = buf_info->next;
+        if (buf_info->backoff.tv_sec || buf_info->backoff.tv_nsec) {
+            sqe = io_uring_get_sqe(ring);
+            io_uring_prep_timeout(sqe, &buf_info->backoff, 0, etime_success ? IORING_TIMEOUT_ETIME_SUCCESS : 0);
+            io_uring_sqe_set_data(sqe, &backoffs[buf_info->slot]);
+            inflight++;
+            if (!etime_success) {
+                continue; // backoff_done() queues the read
+            }
+            io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
         }
-        // printf("Result of the opertion: %d at offset %d\n", cqe->res, ((struct buf_info *)cqe->user_data)->offset);
-        io_uring_cqe_seen(ring, cqe);
+        sqe = io_uring_get_sqe(ring);
+        io_uring_prep_read(sqe, 0, buf_info->buf + buf_info->pos, align_up(buf_info->len) - buf_info->pos,
+                           buf_info->offset + buf_info->pos);
+        io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
+        io_uring_sqe_set_data(sqe, buf_info);
     }
+    io_uring_submit(ring);
 }
 
-int sqpoll_read(struct io_uring *ring, char *filename) {
-    int fd = open(filename, O_RDONLY | __O_DIRECT);
-    if (fd < 0) {
-        perror("open: ");
-        return -errno;
-    }
-    struct stat stat;
-    fstat(fd, &stat);
-    size_t file_size = stat.st_size;
-    struct buf_info *buf_infos = malloc(sizeof(struct buf_info) * (file_size / BUF_SIZE));
-    for (int i = 0; i < file_size / BUF_SIZE; i++) {
-        if (posix_memalign(&buf_infos[i].buf, BUF_SIZE, BUF_SIZE)) {
-            perror("posix_memalign: ");
+/**
+ * reap completions until at most max_inflight requests are outstanding.
+ * every ready cqe is handled in one pass and released with a single cq advance.
+ */
+void check_cqe(struct io_uring *ring, unsigned max_inflight) {
+    struct io_uring_cqe *cqes[REAP_BATCH];
+    while (inflight > max_inflight) {
+        if (!io_uring_cq_ready(ring)) {
+            int ret = io_uring_wait_cqe(ring, &cqes[0]);
+            if (ret < 0) {
+                fprintf(stderr, "Error waiting for completion: %s\n", strerror(-ret));
+                return;
+            }
+        }
+        unsigned nr = io_uring_peek_batch_cqe(ring, cqes, REAP_BATCH);
+        for (unsigned i = 0; i < nr; i++) {
+            struct buf_info *buf_info = io_uring_cqe_get_data(cqes[i]);
+            buf_info->complete(buf_info, cqes[i]->res);
+        }
+        io_uring_cq_advance(ring, nr);
+        if (retries) {
+            queue_retries(ring);
         }
-        memset(buf_infos[i].buf, 0, BUF_SIZE);
-        buf_infos[i].len = BUF_SIZE;
-        buf_infos[i].offset = zigzag_offset(i, file_size);
     }
-    struct io_uring_sqe *sqe;
-    struct io_uring_cqe *cqe;
+}
+
+static int has_link_timeout(void) {
+    return link_timeout.tv_sec || link_timeout.tv_nsec;
+}
 
+/**
+ * queue nr reads as one chain. the kernel issues each read once the previous
+ * one completed, without a round trip to userspace. a failed or short read
+ * cancels the rest of the chain unless it is hardlinked, the cancelled reads
+ * are resubmitted one by one. the tail block's read is always hardlinked, it
+ * comes back short by design. with a link timeout
+ * every read is followed by IORING_OP_LINK_TIMEOUT, which cancels the read
+ * when the deadline passes.
+ */
+int queue_read_chain(struct io_uring *ring, const off_t *offsets, unsigned nr) {
+    unsigned sqes_per_read = has_link_timeout() ? 2 : 1;
+    // every read of the chain needs a buffer up front
+    while (pool.nr_free < nr) {
+        io_uring_submit(ring);
+        check_cqe(ring, inflight - 1);
+    }
+    // a chain cut by the end of a submission is not continued by the next one
+    if (io_uring_sq_space_left(ring) < nr * sqes_per_read) {
+        io_uring_submit(ring);
+    }
+    for (unsigned i = 0; i < nr; i++) {
+        int last = i == nr - 1;
+        struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+        if (!sqe) {
+            fprintf(stderr, "cannot get sqe\n");
+            return -1;
+        }
+        struct buf_info *buf_info = &requests[buf_pool_get(&pool)];
+        buf_info->offset = offsets[i];
+        buf_info->len = file_size - offsets[i] < block_size ? file_size - offsets[i] : block_size;
+        buf_info->done = buf_info->pos = 0;
+        buf_info->retries = 0;
+        // O_DIRECT needs an aligned length, the tail block is rounded up and the read stops at EOF
+        io_uring_prep_read(sqe, 0, buf_info->buf, align_up(buf_info->len), buf_info->offset);
+        // the rounded up tail read stops at EOF, short, which would break a soft link
+        unsigned flag = align_up(buf_info->len) > buf_info->len ? IOSQE_IO_HARDLINK : link_flag;
+        // a linked timeout must directly follow the read it guards
+        io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE | (!last || has_link_timeout() ? flag : 0));
+        io_uring_sqe_set_data(sqe, buf_info);
+        buf_info->complete = read_done;
+        buf_info->submit_ns = hist_now_ns();
+        inflight++;
+
+        if (has_link_timeout()) {
+            sqe = io_uring_get_sqe(ring);
+            io_uring_prep_link_timeout(sqe, &link_timeout, 0);
+            // the link continues past the timeout to the next read
+            io_uring_sqe_set_flags(sqe, last ? 0 : link_flag);
+            io_uring_sqe_set_data(sqe, &timeout_req);
+            inflight++;
+        }
+    }
+    if (nr > 1) {
+        chains++;
+    }
+    // batch submissions until the window or the sq is full
+    if (io_uring_sq_space_left(ring) < sqes_per_read) {
+        io_uring_submit(ring);
+    }
+    return 0;
+}
+
+int sqpoll_read(struct io_uring *ring, char *filename) {
+    int fd = engine_open_file(filename, &file_size, &dio_align);
+    if (fd < 0) {
+        fprintf(stderr, "open %s: %s\n", filename, strerror(-fd));
+        return fd;
+    }
+    // an O_DIRECT read of one block at a block offset is aligned by definition
+    if (dio_align > block_size) {
+        dio_align = block_size;
+    }
+    size_t blocks = file_size / block_size + (file_size % block_size ? 1 : 0);
+    // buffers are recycled, only max_inflight of them exist at any time
+    if (buf_pool_init(&pool, max_inflight, block_size)) {
+        return -1;
+    }
+    requests = calloc(max_inflight, sizeof(struct buf_info));
+    backoffs = calloc(max_inflight, sizeof(struct buf_info));
+    if (!requests || !backoffs) {
+        return -1;
+    }
+    for (unsigned i = 0; i < max_inflight; i++) {
+        requests[i].slot = i;
+        requests[i].buf = buf_pool_slot(&pool, i);
+        backoffs[i].slot = i;
+        backoffs[i].complete = backoff_done;
+    }
     int ret = io_uring_register_files(ring, &fd, 1);
     if (ret) {
         fprintf(stderr, "io_uring_register_files: %s\n", strerror(-ret));
         return ret;
     }
-    for (int i = 0; i < file_size / BUF_SIZE; i++) {
-        if (io_uring_sq_space_left(ring) == 0) {
-            check_cqe(ring);
+    hist_init(&latency);
+    pattern_init(&pattern, blocks, 0);
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < blocks; i += chain_len) {
+        // consecutive reads of the pattern form a chain, e.g. a header then its body
+        off_t offsets[MAX_CHAIN];
+        unsigned nr = blocks - i < chain_len ? blocks - i : chain_len;
+        for (unsigned j = 0; j < nr; j++) {
+            offsets[j] = (off_t)pattern_block(&pattern, i + j) * block_size;
         }
-        sqe = io_uring_get_sqe(ring);
-        if (!sqe) {
-            fprintf(stderr, "cannot get sqe\n");
+        if (queue_read_chain(ring, offsets, nr)) {
             return -1;
         }
-        io_uring_prep_read(sqe, 0, buf_infos[i].buf, buf_infos[i].len, buf_infos[i].offset);
-        io_uring_sqe_set_flags(sqe, IOSQE_FIXED_FILE);
-        io_uring_sqe_set_data(sqe, &buf_infos[i]);
-        io_uring_submit(ring);
     }
-    check_cqe(ring);
-    for (int i = 0; i < file_size / BUF_SIZE; i++) {
-        char *buf = buf_infos[i].buf;
-        free(buf);
+    io_uring_submit(ring);
+    check_cqe(ring, 0);
+    result.elapsed_ns = now_ns() - start;
+    buf_pool_destroy(&pool);
+    free(requests);
+    free(backoffs);
+    return 0;
+}
+
+/**
+ * whether timeouts take IORING_TIMEOUT_ETIME_SUCCESS. kernels before 5.16
+ * refuse the unknown flag with -EINVAL.
+ */
+int probe_etime_success(struct io_uring *ring) {
+    struct __kernel_timespec ts = {.tv_nsec = 1000};
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+    io_uring_prep_timeout(sqe, &ts, 0, IORING_TIMEOUT_ETIME_SUCCESS);
+    struct io_uring_cqe *cqe;
+    int ret = io_uring_submit_and_wait(ring, 1);
+    if (ret >= 0) {
+        ret = io_uring_wait_cqe(ring, &cqe);
+    }
+    if (ret < 0) {
+        return 0;
     }
-    free(buf_infos);
+    ret = cqe->res;
+    io_uring_cqe_seen(ring, cqe);
+    return ret == -ETIME;
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        printf("usage %s filename\n", argv[0]);
+    int format = REPORT_TEXT;
+    parse_pattern("zigzag", &pattern);
+    int opt;
+    while ((opt = getopt(argc, argv, "q:c:i:b:p:L:HT:f:")) != -1) {
+        switch (opt) {
+        case 'b':
+            block_size = parse_size(optarg);
+            if (!valid_block_size(block_size)) {
+                fprintf(stderr, "block size must be a power of two between %d and %d\n", MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+                return -1;
+            }
+            break;
+        case 'q':
+            depth = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            cq_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'i':
+            max_inflight = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            if (parse_pattern(optarg, &pattern)) {
+                fprintf(stderr, "unknown pattern: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 'L':
+            chain_len = strtoul(optarg, NULL, 0);
+            if (!chain_len || chain_len > MAX_CHAIN) {
+                fprintf(stderr, "chain length must be between 1 and %d\n", MAX_CHAIN);
+                return -1;
+            }
+            break;
+        case 'H':
+            // keep the chain going past failed and short reads, e.g. the tail block at EOF
+            link_flag = IOSQE_IO_HARDLINK;
+            break;
+        case 'T': {
+            unsigned long ms = strtoul(optarg, NULL, 0);
+            link_timeout.tv_sec = ms / 1000;
+            link_timeout.tv_nsec = (ms % 1000) * 1000000;
+            break;
+        }
+        case 'f':
+            format = parse_report_format(optarg);
+            if (format < 0) {
+                fprintf(stderr, "unknown format: %s\n", optarg);
+                return -1;
+            }
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            return -1;
+        }
+    }
+    if (optind >= argc || !depth) {
+        fprintf(stderr, USAGE, argv[0]);
+        return -1;
+    }
+    if (!max_inflight) {
+        max_inflight = depth;
+    }
+    unsigned sqes_per_read = has_link_timeout() ? 2 : 1;
+    if (chain_len > max_inflight || chain_len * sqes_per_read > depth) {
+        fprintf(stderr, "a chain of %u reads needs an in-flight limit of %u and a queue depth of %u\n", chain_len,
+                chain_len, chain_len * sqes_per_read);
         return -1;
     }
+    if (!cq_size && max_inflight * sqes_per_read > depth * 2) {
+        cq_size = max_inflight * sqes_per_read; // one cq slot per in-flight request and timeout
+    }
     struct io_uring ring;
     struct io_uring_params params;
 
-    if (geteuid()) {
-        fprintf(stderr, "You need root privileges to run this program.\n");
-        return -EACCES;
-    }
-
     // cpu affinity
     cpu_set_t cpuset;
     CPU_ZERO(&cpuset);
@@ -120,13 +456,49 @@ int main(int argc, char *argv[]) {
     // params.flags |= IORING_SETUP_SQ_AFF; // sq_thread_cpu affinity
     // params.sq_thread_idle = 2000;        // sqpoll kthread go to idle after 2000ms
     // params.sq_thread_cpu = 1;
+    if (cq_size) {
+        params.flags |= IORING_SETUP_CQSIZE;
+        params.cq_entries = cq_size;
+    }
 
-    int ret = io_uring_queue_init_params(8, &ring, &params);
+    int ret = io_uring_queue_init_params(depth, &ring, &params);
     if (ret) {
-        fprintf(stderr, "Unable to setup io_uring: %s\n", strerror(-ret));
-        return -ret;
+        // no privileges needed without SQPOLL, a refusal is policy or age
+        fprintf(stderr, "Unable to setup io_uring: %s%s\n", strerror(-ret),
+                ret == -EPERM || ret == -ENOSYS
+                    ? " (disabled by kernel.io_uring_disabled, a seccomp filter, or a kernel before 5.1)"
+                    : "");
+        return -1;
+    }
+    // IORING_OP_READ came with 5.6, LINK_TIMEOUT with 5.5
+    struct io_uring_probe *probe = io_uring_get_probe_ring(&ring);
+    const char *missing = NULL;
+    if (!probe || !io_uring_opcode_supported(probe, IORING_OP_READ)) {
+        missing = "IORING_OP_READ";
+    } else if (has_link_timeout() && !io_uring_opcode_supported(probe, IORING_OP_LINK_TIMEOUT)) {
+        missing = "IORING_OP_LINK_TIMEOUT, needed by -T";
     }
-    sqpoll_read(&ring, argv[1]);
+    io_uring_free_probe(probe);
+    if (missing) {
+        fprintf(stderr, "this kernel lacks %s\n", missing);
+        io_uring_queue_exit(&ring);
+        return -1;
+    }
+    etime_success = probe_etime_success(&ring);
+    result.block_size = block_size;
+    ret = sqpoll_read(&ring, argv[optind]);
     io_uring_queue_exit(&ring);
-    return 0;
+
+    bench_fill_latency(&result, &latency);
+    report_result(stdout, format, &result);
+    if (format == REPORT_TEXT) {
+        hist_print(stdout, &latency);
+    }
+    if (chain_len > 1 || has_link_timeout()) {
+        fprintf(format == REPORT_TEXT ? stdout : stderr, "  chains %zu, cancelled reads %zu, timeouts fired %zu\n",
+                chains, cancelled, timeouts_fired);
+    }
+    fprintf(format == REPORT_TEXT ? stdout : stderr,
+            "  short reads continued %zu, eagain/eintr retries %zu, failed reads %zu\n", short_reads, retried, failed);
+    return ret || failed ? -1 : 0;
 }
\ No newline at end of file
@@ -0,0 +1,233 @@
+/**
+ * block access patterns shared by the reader programs.
+ *
+ * a pattern maps the i-th read of a run to a block index in [0, blocks).
+ * seq, reverse, zigzag, random and stride visit every block exactly once.
+ * zipf draws blocks with replacement, skewed towards the start of the
+ * range, so the hot blocks form one contiguous range.
+ */
+
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PATTERN_SEED 0x5eed       // default seed of random and zipf
+#define PATTERN_ZIPF_THETA 0.99   // default zipf skew
+#define PATTERN_STRIDE 8          // default stride in blocks
+#define PATTERN_FEISTEL_ROUNDS 4  // rounds of the random permutation
+#define PATTERN_ZETA_EXACT 1000000 // terms of zeta summed exactly, the rest is integrated
+
+enum access_pattern {
+    PATTERN_SEQ,
+    PATTERN_REVERSE,
+    PATTERN_ZIGZAG,
+    PATTERN_RANDOM,
+    PATTERN_ZIPF,
+    PATTERN_STRIDE_BLOCKS,
+};
+
+struct pattern {
+    int type;       // enum access_pattern
+    uint64_t seed;  // random and zipf seed
+    double theta;   // zipf skew, 0 < theta < 1
+    size_t stride;  // stride in blocks
+    size_t blocks;  // blocks in the range, set by pattern_init
+
+    // random: feistel permutation over the next even power of two
+    unsigned half_bits;                    // bits per feistel half
+    uint64_t keys[PATTERN_FEISTEL_ROUNDS]; // round keys
+
+    // zipf: constants of gray et al., "quickly generating billion-record synthetic databases"
+    double zetan;  // zeta(blocks, theta)
+    double alpha;  // 1 / (1 - theta)
+    double eta;    // (1 - (2 / n)^(1 - theta)) / (1 - zeta(2, theta) / zetan)
+    uint64_t rng;  // xorshift state
+};
+
+static inline uint64_t pattern_mix(uint64_t x) {
+    // splitmix64 finalizer
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+/**
+ * parse "seq", "reverse", "zigzag", "random[:seed]", "zipf[:theta]" or
+ * "stride[:blocks]". returns -1 on malformed input.
+ */
+static inline int parse_pattern(const char *spec, struct pattern *p) {
+    memset(p, 0, sizeof(struct pattern));
+    p->seed = PATTERN_SEED;
+    p->theta = PATTERN_ZIPF_THETA;
+    p->stride = PATTERN_STRIDE;
+
+    const char *arg = strchr(spec, ':');
+    size_t len = arg ? (size_t)(arg - spec) : strlen(spec);
+    char *end = NULL;
+    if (arg) {
+        arg++;
+    }
+    if (len == 3 && !strncmp(spec, "seq", len)) {
+        p->type = PATTERN_SEQ;
+    } else if (len == 7 && !strncmp(spec, "reverse", len)) {
+        p->type = PATTERN_REVERSE;
+    } else if (len == 6 && !strncmp(spec, "zigzag", len)) {
+        p->type = PATTERN_ZIGZAG;
+    } else if (len == 6 && !strncmp(spec, "random", len)) {
+        p->type = PATTERN_RANDOM;
+        if (arg) {
+            p->seed = strtoull(arg, &end, 0);
+        }
+    } else if (len == 4 && !strncmp(spec, "zipf", len)) {
+        p->type = PATTERN_ZIPF;
+        if (arg) {
+            p->theta = strtod(arg, &end);
+        }
+        if (p->theta <= 0 || p->theta >= 1) {
+            return -1;
+        }
+    } else if (len == 6 && !strncmp(spec, "stride", len)) {
+        p->type = PATTERN_STRIDE_BLOCKS;
+        if (arg) {
+            p->stride = strtoull(arg, &end, 0);
+        }
+        if (!p->stride) {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    if (arg && (!end || end == arg || *end != '\0')) {
+        return -1; // argument missing, malformed or not accepted by this pattern
+    }
+    return 0;
+}
+
+/**
+ * sum of i^-theta for i in [1, n]. the tail beyond PATTERN_ZETA_EXACT terms
+ * is approximated by its integral plus the trapezoid correction.
+ */
+static inline double pattern_zeta(size_t n, double theta) {
+    size_t exact = n < PATTERN_ZETA_EXACT ? n : PATTERN_ZETA_EXACT;
+    double sum = 0;
+    for (size_t i = 1; i <= exact; i++) {
+        sum += pow((double)i, -theta);
+    }
+    if (n > exact) {
+        double m = exact;
+        sum += (pow((double)n, 1 - theta) - pow(m, 1 - theta)) / (1 - theta);
+        sum += (pow((double)n, -theta) - pow(m, -theta)) / 2;
+    }
+    return sum;
+}
+
+/**
+ * prepare p for a range of blocks. stream tells apart the workers that share
+ * a spec, so each one gets its own random sequence.
+ */
+static inline void pattern_init(struct pattern *p, size_t blocks, unsigned stream) {
+    p->blocks = blocks;
+    uint64_t seed = pattern_mix(p->seed + stream);
+    switch (p->type) {
+    case PATTERN_RANDOM: {
+        unsigned bits = 2;
+        while (bits < 64 && (1ull << bits) < blocks) {
+            bits++;
+        }
+        p->half_bits = (bits + 1) / 2;
+        for (int r = 0; r < PATTERN_FEISTEL_ROUNDS; r++) {
+            seed = pattern_mix(seed);
+            p->keys[r] = seed;
+        }
+        break;
+    }
+    case PATTERN_ZIPF:
+        p->rng = seed | 1;
+        p->zetan = pattern_zeta(blocks, p->theta);
+        p->alpha = 1 / (1 - p->theta);
+        p->eta = (1 - pow(2.0 / blocks, 1 - p->theta)) / (1 - pattern_zeta(2, p->theta) / p->zetan);
+        break;
+    }
+}
+
+/**
+ * bijection on [0, 2^(2 * half_bits))
+ */
+static inline uint64_t pattern_feistel(const struct pattern *p, uint64_t x) {
+    uint64_t mask = (1ull << p->half_bits) - 1;
+    uint64_t left = x >> p->half_bits, right = x & mask;
+    for (int r = 0; r < PATTERN_FEISTEL_ROUNDS; r++) {
+        uint64_t next = left ^ (pattern_mix(right ^ p->keys[r]) & mask);
+        left = right;
+        right = next;
+    }
+    return (left << p->half_bits) | right;
+}
+
+static inline double pattern_uniform(struct pattern *p) {
+    // xorshift64*, top 53 bits as a double in [0, 1)
+    p->rng ^= p->rng >> 12;
+    p->rng ^= p->rng << 25;
+    p->rng ^= p->rng >> 27;
+    return ((p->rng * 0x2545f4914f6cdd1dull) >> 11) * 0x1.0p-53;
+}
+
+/**
+ * block index of the n-th read, n in [0, blocks)
+ */
+static inline size_t pattern_block(struct pattern *p, size_t n) {
+    switch (p->type) {
+    case PATTERN_REVERSE:
+        return p->blocks - n - 1;
+    case PATTERN_ZIGZAG:
+        // first block, last block, second block, ...
+        return (n % 2) ? (p->blocks - (n / 2) - 1) : n / 2;
+    case PATTERN_RANDOM: {
+        // cycle-walk the permutation until it lands inside the range,
+        // the domain is less than four times the range so this is short
+        uint64_t x = n;
+        do {
+            x = pattern_feistel(p, x);
+        } while (x >= p->blocks);
+        return x;
+    }
+    case PATTERN_ZIPF: {
+        double u = pattern_uniform(p);
+        double uz = u * p->zetan;
+        if (uz < 1) {
+            return 0;
+        }
+        if (p->blocks > 1 && uz < 1 + pow(0.5, p->theta)) {
+            return 1;
+        }
+        size_t block = p->blocks * pow(p->eta * u - p->eta + 1, p->alpha);
+        return block < p->blocks ? block : p->blocks - 1;
+    }
+    case PATTERN_STRIDE_BLOCKS: {
+        // 0, s, 2s, ... then 1, s + 1, ... until every block was visited
+        size_t stride = p->stride < p->blocks ? p->stride : p->blocks;
+        size_t full = p->blocks / stride, extra = p->blocks % stride;
+        // the first `extra` columns have one more row
+        size_t col, row;
+        if (n < extra * (full + 1)) {
+            col = n / (full + 1);
+            row = n % (full + 1);
+        } else {
+            n -= extra * (full + 1);
+            col = extra + n / full;
+            row = n % full;
+        }
+        return row * stride + col;
+    }
+    default:
+        return n;
+    }
+}
+
+#endif
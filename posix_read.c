@@ -1,39 +1,334 @@
+/**
+ * blocking pread(2) baseline, read through the engine library's pread
+ * backend. with -t N the blocks are split into ranges of -r blocks, dealt
+ * out evenly to N threads; a thread that runs out steals half of the ranges
+ * another thread has not started, so a slow device region or a descheduled
+ * thread does not leave the others idle at the end. the threads together
+ * keep up to N reads in flight, the counterpart of an io_uring queue depth
+ * of N.
+ */
+
 #define _GNU_SOURCE
 
-#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 #include <unistd.h>
 
-#define BUF_SIZE 4096
+#include "bench.h"
+#include "engine/engine.h"
+#include "pattern.h"
+
+#define BUF_SIZE 4096     // default block size
+#define RANGE_BLOCKS 64   // default blocks per range, the unit of stealing
+#define MAX_THREADS 256
+#define MAX_RETRIES 8     // EAGAIN / EINTR retries of one read before it fails
+#define USAGE "usage: %s [-b block_size] [-p pattern] [-t threads] [-r range_blocks] [-f text|csv|json] filename\n"
+
+struct worker {
+    pthread_t thread;
+    int id;
+    // ranges not started yet, next << 32 | end. the owner takes from the
+    // front, thieves cut off the back half, both with a compare and swap
+    uint64_t ranges;
+    struct pattern pattern;  // private copy, zipf draws change its state
+    char *buf;               // one block, reused for every read
+    struct engine *engine;   // blocking pread backend, one read in flight
+    struct engine_req req;   // the read of the current block
+    off_t offset;            // file offset of the current block
+    size_t expected;         // bytes of the current block before EOF
+    size_t done;             // bytes of the current block read so far
+    unsigned retries;        // EAGAIN / EINTR retries of the current block
+    struct histogram latency;
+    struct bench_result result;
+    size_t steals;           // successful steals by this worker
+    size_t short_reads;      // short reads continued
+    size_t retried;          // EAGAIN / EINTR retries
+    size_t failed;           // reads given up on, their bytes are missing from the result
+};
+
+static int fd;
+static size_t block_size = BUF_SIZE;
+static size_t range_blocks = RANGE_BLOCKS;
+static size_t file_size;
+static size_t dio_align; // offset alignment of continued reads, 1 when buffered
+static size_t blocks;
+static int nr_threads = 1;
+static struct worker *workers;
+static pthread_barrier_t start_barrier;
+
+static inline uint64_t pack_ranges(uint32_t next, uint32_t end) {
+    return (uint64_t)next << 32 | end;
+}
+
+/**
+ * take half of another worker's remaining ranges, the first one for the
+ * caller to read now and the rest as its own. returns 0 once every other
+ * worker looked empty. a range moving between a victim and a thief may be
+ * missed, the thief reads it, so at worst the caller stops a little early.
+ */
+int steal_range(struct worker *w, uint32_t *range) {
+    for (int k = 1; k < nr_threads; k++) {
+        struct worker *victim = &workers[(w->id + k) % nr_threads];
+        uint64_t old = __atomic_load_n(&victim->ranges, __ATOMIC_ACQUIRE);
+        for (;;) {
+            uint32_t next = old >> 32, end = (uint32_t)old;
+            if (next >= end) {
+                break;
+            }
+            uint32_t mid = end - (end - next + 1) / 2;
+            if (__atomic_compare_exchange_n(&victim->ranges, &old, pack_ranges(next, mid), 0, __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE)) {
+                // our own ranges are empty, nobody else changes them
+                __atomic_store_n(&w->ranges, pack_ranges(mid + 1, end), __ATOMIC_RELEASE);
+                w->steals++;
+                *range = mid;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * next range for w to read, its own first. returns 0 when there is none.
+ */
+int next_range(struct worker *w, uint32_t *range) {
+    uint64_t old = __atomic_load_n(&w->ranges, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t next = old >> 32, end = (uint32_t)old;
+        if (next >= end) {
+            return steal_range(w, range);
+        }
+        if (__atomic_compare_exchange_n(&w->ranges, &old, pack_ranges(next + 1, end), 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            *range = next;
+            return 1;
+        }
+    }
+}
+
+/**
+ * completion of a block read, handled the way the io_uring readers handle
+ * theirs: EAGAIN / EINTR are retried and short reads continued from an
+ * aligned offset, only bytes that arrived are counted. a read that is not
+ * finished is submitted again and runs on the next poll.
+ */
+void read_done(struct engine_req *req) {
+    struct worker *w = req->data;
+    size_t pos = req->offset - w->offset;
+    if ((req->res == -EAGAIN || req->res == -EINTR) && w->retries < MAX_RETRIES) {
+        w->retries++;
+        w->retried++;
+        engine_submit(w->engine, req);
+        return;
+    }
+    if (req->res < 0) {
+        fprintf(stderr, "worker %d: pread: %s at offset %ld\n", w->id, strerror(-req->res), req->offset);
+        w->failed++;
+        return;
+    }
+    if (pos + req->res <= w->done) {
+        fprintf(stderr, "worker %d: unexpected EOF at offset %ld, the file shrank\n", w->id, w->offset + w->done);
+        w->failed++;
+        return;
+    }
+    w->result.bytes += pos + req->res - w->done;
+    w->done = pos + req->res;
+    if (w->done < w->expected) {
+        // O_DIRECT continues from an aligned offset, the partial block is read again
+        pos = w->done / dio_align * dio_align;
+        req->buf = w->buf + pos;
+        req->len = block_size - pos;
+        req->offset = w->offset + pos;
+        w->short_reads++;
+        engine_submit(w->engine, req);
+    }
+}
+
+/**
+ * read the block at offset into w->buf through the worker's engine
+ */
+void read_block(struct worker *w, off_t offset) {
+    w->offset = offset;
+    // the tail block is read in full as O_DIRECT needs an aligned length, pread() stops at EOF
+    w->expected = file_size - offset < block_size ? file_size - offset : block_size;
+    w->done = 0;
+    w->retries = 0;
+    w->req.buf = w->buf;
+    w->req.len = block_size;
+    w->req.offset = offset;
+    uint64_t submit = hist_now_ns();
+    engine_submit(w->engine, &w->req);
+    engine_drain(w->engine);
+    hist_record(&w->latency, hist_now_ns() - submit);
+    if (w->done == w->expected) {
+        w->result.ops++;
+    }
+}
+
+void *worker_main(void *arg) {
+    struct worker *w = arg;
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start = now_ns();
+    uint32_t range;
+    while (next_range(w, &range)) {
+        size_t first = (size_t)range * range_blocks;
+        size_t last = first + range_blocks < blocks ? first + range_blocks : blocks;
+        for (size_t i = first; i < last; i++) {
+            read_block(w, (off_t)pattern_block(&w->pattern, i) * block_size);
+        }
+    }
+    w->result.elapsed_ns = now_ns() - start;
+    return NULL;
+}
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        printf("usage %s filename\n", argv[1]);
+    int format = REPORT_TEXT;
+    struct pattern pattern;
+    parse_pattern("zigzag", &pattern);
+    int opt;
+    while ((opt = getopt(argc, argv, "b:p:t:r:f:")) != -1) {
+        switch (opt) {
+        case 'b':
+            block_size = parse_size(optarg);
+            if (!valid_block_size(block_size)) {
+                fprintf(stderr, "block size must be a power of two between %d and %d\n", MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+                return -1;
+            }
+            break;
+        case 'p':
+            if (parse_pattern(optarg, &pattern)) {
+                fprintf(stderr, "unknown pattern: %s\n", optarg);
+                return -1;
+            }
+            break;
+        case 't':
+            nr_threads = atoi(optarg);
+            if (nr_threads < 1 || nr_threads > MAX_THREADS) {
+                fprintf(stderr, "threads must be between 1 and %d\n", MAX_THREADS);
+                return -1;
+            }
+            break;
+        case 'r':
+            range_blocks = parse_size(optarg);
+            if (!range_blocks) {
+                fprintf(stderr, "a range needs at least one block\n");
+                return -1;
+            }
+            break;
+        case 'f':
+            format = parse_report_format(optarg);
+            if (format < 0) {
+                fprintf(stderr, "unknown format: %s\n", optarg);
+                return -1;
+            }
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            return -1;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, USAGE, argv[0]);
         return -1;
     }
 
-    int fd = open(argv[1], O_RDONLY | O_DIRECT);
+    fd = engine_open_file(argv[optind], &file_size, &dio_align);
     if (fd < 0) {
-        perror("open: ");
+        fprintf(stderr, "open %s: %s\n", argv[optind], strerror(-fd));
+        return -1;
+    }
+    blocks = file_size / block_size + (file_size % block_size ? 1 : 0);
+    size_t nr_ranges = blocks / range_blocks + (blocks % range_blocks ? 1 : 0);
+    if (nr_ranges > UINT32_MAX) {
+        fprintf(stderr, "too many ranges, raise -r\n");
         return -1;
     }
+    // one pattern over the whole file, the threads read disjoint slices of it
+    pattern_init(&pattern, blocks, 0);
 
-    struct stat stat;
-    if (fstat(fd, &stat)) {
-        perror("fstat: ");
+    workers = calloc(nr_threads, sizeof(struct worker));
+    if (!workers) {
         return -1;
     }
-    size_t file_size = stat.st_size;
-    size_t blocks = file_size / BUF_SIZE + (file_size % BUF_SIZE ? 1 : 0);
-    char *buf = calloc(1, file_size);
-    for (int i = 0; i < blocks; i++) {
-        size_t zigzag_block = (i % 2) ? (blocks - (i / 2) - 1) : (i / 2);
-        size_t offset = zigzag_block * BUF_SIZE;
-        lseek(fd, offset, SEEK_SET);
-        read(fd, buf + offset, (zigzag_block == blocks - 1) ? (file_size % BUF_SIZE) : BUF_SIZE);
+    pthread_barrier_init(&start_barrier, NULL, nr_threads + 1);
+    for (int i = 0; i < nr_threads; i++) {
+        struct worker *w = &workers[i];
+        w->id = i;
+        w->ranges = pack_ranges(nr_ranges * i / nr_threads, nr_ranges * (i + 1) / nr_threads);
+        w->pattern = pattern;
+        // permutations are shared, zipf draws get a stream per thread
+        if (i) {
+            w->pattern.rng = pattern_mix(pattern.rng + i) | 1;
+        }
+        hist_init(&w->latency);
+        int err;
+        struct engine_params params = {.depth = 1};
+        w->engine = engine_create("pread", &params, &err);
+        if (!w->engine) {
+            fprintf(stderr, "engine_create: %s\n", strerror(-err));
+            return -1;
+        }
+        w->req.fd = fd;
+        w->req.data = w;
+        w->req.complete = read_done;
+        // O_DIRECT needs the buffer aligned
+        if (posix_memalign((void **)&w->buf, BUF_ALIGN, block_size)) {
+            perror("posix_memalign: ");
+            return -1;
+        }
+        if (pthread_create(&w->thread, NULL, worker_main, w)) {
+            perror("pthread_create: ");
+            return -1;
+        }
     }
+
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start = now_ns();
+    for (int i = 0; i < nr_threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    struct histogram latency;
+    hist_init(&latency);
+    struct bench_result result = {.engine = "posix_read", .block_size = block_size};
+    result.elapsed_ns = now_ns() - start;
     close(fd);
-}
\ No newline at end of file
+    size_t steals = 0, short_reads = 0, retried = 0, failed = 0;
+    for (int i = 0; i < nr_threads; i++) {
+        struct worker *w = &workers[i];
+        result.bytes += w->result.bytes;
+        result.ops += w->result.ops;
+        steals += w->steals;
+        short_reads += w->short_reads;
+        retried += w->retried;
+        failed += w->failed;
+        hist_merge(&latency, &w->latency);
+        if (nr_threads > 1 && format == REPORT_TEXT) {
+            double secs = w->result.elapsed_ns / 1e9;
+            printf("worker %d: %zu bytes, %.2f MB/s, %zu steals\n", w->id, w->result.bytes,
+                   secs > 0 ? w->result.bytes / (1024.0 * 1024.0) / secs : 0, w->steals);
+        }
+        engine_destroy(w->engine);
+        free(w->buf);
+    }
+    free(workers);
+
+    bench_fill_latency(&result, &latency);
+    report_result(stdout, format, &result);
+    if (format == REPORT_TEXT) {
+        hist_print(stdout, &latency);
+    }
+    if (nr_threads > 1) {
+        // steals measure how unevenly the threads progressed
+        fprintf(format == REPORT_TEXT ? stdout : stderr, "  %d threads, %zu ranges of %zu blocks, %zu stolen\n",
+                nr_threads, nr_ranges, range_blocks, steals);
+    }
+    fprintf(format == REPORT_TEXT ? stdout : stderr,
+            "  short reads continued %zu, eagain/eintr retries %zu, failed reads %zu\n", short_reads, retried, failed);
+    return failed ? -1 : 0;
+}
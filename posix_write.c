@@ -0,0 +1,134 @@
+/**
+ * write-ahead log baseline: sequential O_DIRECT pwrite, fdatasync after
+ * every group of sync_every blocks.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define BUF_SIZE 4096            // default block size
+#define LOG_SIZE (64ul << 20)    // default bytes written
+#define USAGE "usage: %s [-b block_size] [-s size] [-S sync_every] [-f text|csv|json] filename\n"
+
+int main(int argc, char *argv[]) {
+    int format = REPORT_TEXT;
+    size_t block_size = BUF_SIZE;
+    size_t size = LOG_SIZE;
+    unsigned sync_every = 1; // blocks per fdatasync, 0 never syncs
+    int opt;
+    while ((opt = getopt(argc, argv, "b:s:S:f:")) != -1) {
+        switch (opt) {
+        case 'b':
+            block_size = parse_size(optarg);
+            if (!valid_block_size(block_size)) {
+                fprintf(stderr, "block size must be a power of two between %d and %d\n", MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+                return -1;
+            }
+            break;
+        case 's':
+            size = parse_size(optarg);
+            break;
+        case 'S':
+            sync_every = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            format = parse_report_format(optarg);
+            if (format < 0) {
+                fprintf(stderr, "unknown format: %s\n", optarg);
+                return -1;
+            }
+            break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            return -1;
+        }
+    }
+    if (optind >= argc || !size) {
+        fprintf(stderr, USAGE, argv[0]);
+        return -1;
+    }
+
+    int fd = open(argv[optind], O_WRONLY | O_CREAT | O_DIRECT, 0644);
+    if (fd < 0) {
+        perror("open: ");
+        return -1;
+    }
+    size_t blocks = size / block_size + (size % block_size ? 1 : 0);
+    // logs are preallocated, so the timed writes overwrite allocated blocks
+    int ret = posix_fallocate(fd, 0, blocks * block_size);
+    if (ret) {
+        fprintf(stderr, "posix_fallocate: %s\n", strerror(ret));
+        return -1;
+    }
+    if (fdatasync(fd)) {
+        perror("fdatasync: ");
+        return -1;
+    }
+
+    char *buf;
+    // one block buffer reused for every write. O_DIRECT needs it aligned
+    if (posix_memalign((void **)&buf, BUF_ALIGN, block_size)) {
+        perror("posix_memalign: ");
+        return -1;
+    }
+    memset(buf, 0xa5, block_size);
+
+    // latency of a commit: first write of the group until fdatasync returns
+    struct histogram latency;
+    hist_init(&latency);
+    struct bench_result result = {.engine = "posix_write", .block_size = block_size};
+
+    size_t failed_writes = 0; // writes that failed or came back short
+    size_t failed_syncs = 0;  // fdatasyncs that failed, their group is not durable
+    uint64_t start = now_ns();
+    uint64_t group = 0;
+    for (size_t i = 0; i < blocks; i++) {
+        uint64_t submit = hist_now_ns();
+        if (!sync_every || i % sync_every == 0) {
+            group = submit;
+        }
+        ssize_t ret = pwrite(fd, buf, block_size, (off_t)i * block_size);
+        if (ret < 0) {
+            perror("pwrite: ");
+            failed_writes++;
+            continue;
+        }
+        result.bytes += ret;
+        if (ret < block_size) {
+            // O_DIRECT into preallocated blocks does not come back short on a healthy device
+            fprintf(stderr, "pwrite: %zd of %zu bytes at offset %zu\n", ret, block_size, i * block_size);
+            failed_writes++;
+            continue;
+        }
+        result.ops++;
+        if (!sync_every) {
+            hist_record(&latency, hist_now_ns() - submit);
+        } else if ((i + 1) % sync_every == 0 || i + 1 == blocks) {
+            if (fdatasync(fd)) {
+                perror("fdatasync: ");
+                failed_syncs++;
+            }
+            hist_record(&latency, hist_now_ns() - group);
+        }
+    }
+    result.elapsed_ns = now_ns() - start;
+    close(fd);
+
+    bench_fill_latency(&result, &latency);
+    report_result(stdout, format, &result);
+    if (format == REPORT_TEXT) {
+        hist_print(stdout, &latency);
+    }
+    fprintf(format == REPORT_TEXT ? stdout : stderr, "  failed writes %zu, failed fdatasyncs %zu\n", failed_writes,
+            failed_syncs);
+    free(buf);
+    return failed_writes || failed_syncs ? -1 : 0;
+}
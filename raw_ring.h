@@ -0,0 +1,284 @@
+/**
+ * io_uring ring driven with the raw syscalls, no liburing. header only, so
+ * static builds need nothing beyond the kernel uapi headers.
+ *
+ * memory ordering follows the kernel's io_uring.h contract:
+ *   - sq tail: the sqes are written first, then the tail is published with
+ *     one release store per submit, however many sqes were queued
+ *   - sq head: read with acquire, the kernel releases it once it is done
+ *     with the sqes before it
+ *   - cq tail: read with acquire before the cqes behind it are read
+ *   - cq head: published with release once the cqes are consumed
+ *   - sq flags: with SQPOLL, a full fence sits between publishing the tail
+ *     and reading IORING_SQ_NEED_WAKEUP. otherwise the load may pass the
+ *     store, the sq thread goes to sleep without seeing the new tail and
+ *     nobody wakes it
+ *
+ * SQE128 and CQE32 rings are not supported.
+ *
+ *     raw_ring_init(&ring, 64, &params);
+ *     sqe = raw_ring_get_sqe(&ring);
+ *     raw_ring_prep_read(sqe, fd, buf, len, offset, data);
+ *     raw_ring_submit(&ring, 1);
+ *     n = raw_ring_peek_batch(&ring, cqes, max);
+ *     raw_ring_cq_advance(&ring, n);
+ */
+
+#ifndef RAW_RING_H
+#define RAW_RING_H
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef IORING_SQ_TASKRUN
+#define IORING_SQ_TASKRUN (1U << 2) // uapi headers older than 5.19
+#endif
+
+struct raw_ring {
+    int fd;
+    unsigned flags;    // setup flags
+    unsigned features; // IORING_FEAT_*
+
+    // sq, k* point into the shared mapping
+    unsigned *sq_khead;   // consumed by the kernel
+    unsigned *sq_ktail;   // published by us
+    unsigned *sq_kflags;  // IORING_SQ_*
+    unsigned *sq_array;   // sq index -> sqe index, filled 1:1 at init
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail;    // local tail, sqes up to it are filled but maybe not published
+
+    // cq
+    unsigned *cq_khead;   // published by us
+    unsigned *cq_ktail;   // published by the kernel
+    unsigned cq_mask;
+    unsigned cq_entries;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;        // mapping holding the sq indices, and the cq with SINGLE_MMAP
+    size_t sq_ring_size;
+    void *cq_ring;        // == sq_ring with SINGLE_MMAP
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+static inline int raw_ring_setup(unsigned entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int raw_ring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline void raw_ring_unmap(struct raw_ring *r) {
+    if (r->sqes) {
+        munmap(r->sqes, r->sqes_size);
+    }
+    if (r->cq_ring && r->cq_ring != r->sq_ring) {
+        munmap(r->cq_ring, r->cq_ring_size);
+    }
+    if (r->sq_ring) {
+        munmap(r->sq_ring, r->sq_ring_size);
+    }
+}
+
+static inline void *raw_ring_mmap(int fd, size_t size, off_t offset) {
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/**
+ * set up a ring of entries sqes with the flags and sq thread settings in p
+ * and map it. p is updated by the kernel. returns 0 or -errno.
+ */
+static inline int raw_ring_init(struct raw_ring *r, unsigned entries, struct io_uring_params *p) {
+    memset(r, 0, sizeof(struct raw_ring));
+#ifdef IORING_SETUP_SQE128
+    if (p->flags & (IORING_SETUP_SQE128 | IORING_SETUP_CQE32)) {
+        return -EINVAL;
+    }
+#endif
+    r->fd = raw_ring_setup(entries, p);
+    if (r->fd < 0) {
+        return -errno;
+    }
+    r->flags = p->flags;
+    r->features = p->features;
+    r->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        // one mapping backs both rings, size it for the larger one
+        if (r->cq_ring_size > r->sq_ring_size) {
+            r->sq_ring_size = r->cq_ring_size;
+        }
+        r->cq_ring_size = r->sq_ring_size;
+    }
+    r->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ring = raw_ring_mmap(r->fd, r->sq_ring_size, IORING_OFF_SQ_RING);
+    if (!r->sq_ring) {
+        goto err;
+    }
+    if (p->features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = raw_ring_mmap(r->fd, r->cq_ring_size, IORING_OFF_CQ_RING);
+        if (!r->cq_ring) {
+            goto err;
+        }
+    }
+    r->sqes = raw_ring_mmap(r->fd, r->sqes_size, IORING_OFF_SQES);
+    if (!r->sqes) {
+        goto err;
+    }
+
+    char *sq = r->sq_ring;
+    r->sq_khead = (unsigned *)(sq + p->sq_off.head);
+    r->sq_ktail = (unsigned *)(sq + p->sq_off.tail);
+    r->sq_kflags = (unsigned *)(sq + p->sq_off.flags);
+    r->sq_array = (unsigned *)(sq + p->sq_off.array);
+    r->sq_mask = *(unsigned *)(sq + p->sq_off.ring_mask);
+    r->sq_entries = *(unsigned *)(sq + p->sq_off.ring_entries);
+    r->sqe_tail = *r->sq_ktail;
+    for (unsigned i = 0; i < r->sq_entries; i++) {
+        r->sq_array[i] = i;
+    }
+    char *cq = r->cq_ring;
+    r->cq_khead = (unsigned *)(cq + p->cq_off.head);
+    r->cq_ktail = (unsigned *)(cq + p->cq_off.tail);
+    r->cq_mask = *(unsigned *)(cq + p->cq_off.ring_mask);
+    r->cq_entries = *(unsigned *)(cq + p->cq_off.ring_entries);
+    r->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+    return 0;
+err: {
+    int ret = -errno;
+    raw_ring_unmap(r);
+    close(r->fd);
+    return ret;
+}
+}
+
+static inline void raw_ring_exit(struct raw_ring *r) {
+    raw_ring_unmap(r);
+    close(r->fd);
+    memset(r, 0, sizeof(struct raw_ring));
+}
+
+/**
+ * sqes filled but not yet consumed by the kernel
+ */
+static inline unsigned raw_ring_sq_ready(const struct raw_ring *r) {
+    return r->sqe_tail - __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * next free sqe, or NULL when the sq is full. the sqe is not cleared, the
+ * prep helpers fill every field.
+ */
+static inline struct io_uring_sqe *raw_ring_get_sqe(struct raw_ring *r) {
+    if (raw_ring_sq_ready(r) >= r->sq_entries) {
+        return NULL;
+    }
+    return &r->sqes[r->sqe_tail++ & r->sq_mask];
+}
+
+static inline void raw_ring_prep_rw(struct io_uring_sqe *sqe, int op, int fd, const void *addr, unsigned len,
+                                    uint64_t offset, uint64_t user_data) {
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)addr;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+}
+
+static inline void raw_ring_prep_read(struct io_uring_sqe *sqe, int fd, void *buf, unsigned len, uint64_t offset,
+                                      uint64_t user_data) {
+    raw_ring_prep_rw(sqe, IORING_OP_READ, fd, buf, len, offset, user_data);
+}
+
+static inline void raw_ring_prep_nop(struct io_uring_sqe *sqe, uint64_t user_data) {
+    raw_ring_prep_rw(sqe, IORING_OP_NOP, -1, NULL, 0, 0, user_data);
+}
+
+/**
+ * publish every sqe queued since the last flush with a single release store
+ * of the tail. returns the number published.
+ */
+static inline unsigned raw_ring_flush(struct raw_ring *r) {
+    unsigned tail = *r->sq_ktail; // only we write it
+    if (tail != r->sqe_tail) {
+        __atomic_store_n(r->sq_ktail, r->sqe_tail, __ATOMIC_RELEASE);
+    }
+    return r->sqe_tail - tail;
+}
+
+/**
+ * publish the queued sqes and wait for wait_nr completions. without SQPOLL
+ * every call with work enters the kernel once. with SQPOLL the kernel is
+ * only entered to wake a sleeping sq thread, to wait, or to flush an
+ * overflowed cq. returns the sqes published or -errno.
+ */
+static inline int raw_ring_submit(struct raw_ring *r, unsigned wait_nr) {
+    unsigned submitted = raw_ring_flush(r);
+    unsigned flags = 0;
+    if (r->flags & IORING_SETUP_SQPOLL) {
+        // order the tail store before the flags load, see the top of the file
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        unsigned kflags = __atomic_load_n(r->sq_kflags, __ATOMIC_RELAXED);
+        if (kflags & IORING_SQ_NEED_WAKEUP) {
+            flags |= IORING_ENTER_SQ_WAKEUP;
+        }
+        if (kflags & (IORING_SQ_CQ_OVERFLOW | IORING_SQ_TASKRUN)) {
+            flags |= IORING_ENTER_GETEVENTS;
+        }
+        if (!flags && !wait_nr) {
+            return submitted;
+        }
+        // the sq thread consumes the sqes, to_submit only matters for the wakeup
+    }
+    // everything published and not yet consumed, normally just this batch
+    unsigned to_submit = *r->sq_ktail - __atomic_load_n(r->sq_khead, __ATOMIC_ACQUIRE);
+    if (!(r->flags & IORING_SETUP_SQPOLL) && !to_submit && !wait_nr) {
+        return 0;
+    }
+    if (wait_nr) {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+    int ret = raw_ring_enter(r->fd, to_submit, wait_nr, flags);
+    if (ret < 0) {
+        return -errno;
+    }
+    return submitted;
+}
+
+/**
+ * copy up to max ready cqes into cqes without consuming them. returns the
+ * number copied, hand them back with raw_ring_cq_advance().
+ */
+static inline unsigned raw_ring_peek_batch(struct raw_ring *r, struct io_uring_cqe **cqes, unsigned max) {
+    unsigned head = *r->cq_khead; // only we write it
+    unsigned ready = __atomic_load_n(r->cq_ktail, __ATOMIC_ACQUIRE) - head;
+    if (ready > max) {
+        ready = max;
+    }
+    for (unsigned i = 0; i < ready; i++) {
+        cqes[i] = &r->cqes[(head + i) & r->cq_mask];
+    }
+    return ready;
+}
+
+static inline void raw_ring_cq_advance(struct raw_ring *r, unsigned nr) {
+    if (nr) {
+        __atomic_store_n(r->cq_khead, *r->cq_khead + nr, __ATOMIC_RELEASE);
+    }
+}
+
+#endif
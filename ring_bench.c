@@ -0,0 +1,203 @@
+/**
+ * submit path microbenchmark: batches of NOPs through liburing and through
+ * raw_ring.h on identically configured rings. NOPs do no i/o, so the time is
+ * the cost of filling sqes, publishing the tail, entering the kernel and
+ * reaping cqes. each path runs several rounds and reports its best.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <liburing.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "raw_ring.h"
+
+#define NOPS 1000000 // default nops per path
+#define BATCH 32     // default nops per submit
+#define SQ_IDLE_MS 2000
+#define REAP_BATCH 256
+#define ROUNDS 5     // default rounds per path, the best one is reported
+#define USAGE "usage %s [-n nops] [-B batch] [-r rounds] [-S] [-c sq_cpu]\n"
+
+static size_t nops = NOPS;
+static unsigned batch = BATCH;
+static unsigned rounds = ROUNDS;
+static int sqpoll;
+static int sq_cpu = -1;
+
+struct path_result {
+    const char *name;
+    uint64_t submit_ns; // filling sqes and submitting
+    uint64_t total_ns;  // submitting, waiting and reaping
+};
+
+static void init_params(struct io_uring_params *params) {
+    memset(params, 0, sizeof(struct io_uring_params));
+    if (sqpoll) {
+        params->flags = IORING_SETUP_SQPOLL;
+        params->sq_thread_idle = SQ_IDLE_MS;
+        if (sq_cpu >= 0) {
+            params->flags |= IORING_SETUP_SQ_AFF;
+            params->sq_thread_cpu = sq_cpu;
+        }
+    }
+}
+
+static int run_liburing(struct path_result *res) {
+    struct io_uring ring;
+    struct io_uring_params params;
+    struct io_uring_cqe *cqes[REAP_BATCH];
+    init_params(&params);
+    int ret = io_uring_queue_init_params(batch, &ring, &params);
+    if (ret) {
+        fprintf(stderr, "liburing: %s\n", strerror(-ret));
+        return ret;
+    }
+    uint64_t start = now_ns();
+    for (size_t done = 0; done < nops; done += batch) {
+        uint64_t t0 = now_ns();
+        for (unsigned i = 0; i < batch; i++) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+            if (!sqe) {
+                break; // the ring has batch entries, never taken
+            }
+            io_uring_prep_nop(sqe);
+        }
+        ret = io_uring_submit(&ring);
+        res->submit_ns += now_ns() - t0;
+        if (ret < 0) {
+            fprintf(stderr, "io_uring_submit: %s\n", strerror(-ret));
+            break;
+        }
+        for (unsigned reaped = 0; reaped < batch;) {
+            unsigned nr = io_uring_peek_batch_cqe(&ring, cqes, REAP_BATCH);
+            if (!nr) {
+                ret = io_uring_submit_and_wait(&ring, 1);
+                if (ret < 0) {
+                    fprintf(stderr, "io_uring_submit_and_wait: %s\n", strerror(-ret));
+                    goto out;
+                }
+                continue;
+            }
+            io_uring_cq_advance(&ring, nr);
+            reaped += nr;
+        }
+    }
+    ret = 0;
+out:
+    res->total_ns = now_ns() - start;
+    io_uring_queue_exit(&ring);
+    return ret;
+}
+
+static int run_raw_ring(struct path_result *res) {
+    struct raw_ring ring;
+    struct io_uring_params params;
+    struct io_uring_cqe *cqes[REAP_BATCH];
+    init_params(&params);
+    int ret = raw_ring_init(&ring, batch, &params);
+    if (ret) {
+        fprintf(stderr, "raw_ring: %s\n", strerror(-ret));
+        return ret;
+    }
+    uint64_t start = now_ns();
+    for (size_t done = 0; done < nops; done += batch) {
+        uint64_t t0 = now_ns();
+        for (unsigned i = 0; i < batch; i++) {
+            struct io_uring_sqe *sqe = raw_ring_get_sqe(&ring);
+            if (!sqe) {
+                break; // the ring has batch entries, never taken
+            }
+            raw_ring_prep_nop(sqe, 0);
+        }
+        ret = raw_ring_submit(&ring, 0);
+        res->submit_ns += now_ns() - t0;
+        if (ret < 0) {
+            fprintf(stderr, "raw_ring_submit: %s\n", strerror(-ret));
+            break;
+        }
+        for (unsigned reaped = 0; reaped < batch;) {
+            unsigned nr = raw_ring_peek_batch(&ring, cqes, REAP_BATCH);
+            if (!nr) {
+                ret = raw_ring_submit(&ring, 1);
+                if (ret < 0) {
+                    fprintf(stderr, "raw_ring_submit: %s\n", strerror(-ret));
+                    goto out;
+                }
+                continue;
+            }
+            raw_ring_cq_advance(&ring, nr);
+            reaped += nr;
+        }
+    }
+    ret = 0;
+out:
+    res->total_ns = now_ns() - start;
+    raw_ring_exit(&ring);
+    return ret;
+}
+
+static void print_path(const struct path_result *res, size_t ops) {
+    printf("%-9s submit %6.1f ns/op, total %6.1f ns/op, %6.2f Mops/s\n", res->name, (double)res->submit_ns / ops,
+           (double)res->total_ns / ops, ops * 1e3 / res->total_ns);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "n:B:r:Sc:")) != -1) {
+        switch (opt) {
+        case 'n':
+            nops = parse_size(optarg);
+            break;
+        case 'B':
+            batch = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rounds = strtoul(optarg, NULL, 0);
+            break;
+        case 'S':
+            sqpoll = 1;
+            break;
+        case 'c':
+            sq_cpu = strtol(optarg, NULL, 0);
+            break;
+        default:
+            printf(USAGE, argv[0]);
+            return -1;
+        }
+    }
+    if (!nops || !batch || batch > REAP_BATCH || !rounds) {
+        fprintf(stderr, "need at least one nop and a batch between 1 and %d\n", REAP_BATCH);
+        return -1;
+    }
+    size_t ops = (nops + batch - 1) / batch * batch;
+
+    // the paths take turns going first: a ring torn down just before, and
+    // with SQPOLL its sq thread, still costs cpu time in the next run
+    struct path_result liburing = {.name = "liburing"};
+    struct path_result raw = {.name = "raw_ring"};
+    for (unsigned r = 0; r < rounds; r++) {
+        struct path_result lr = {.name = "liburing"};
+        struct path_result rr = {.name = "raw_ring"};
+        int ret = r % 2 ? run_raw_ring(&rr) || run_liburing(&lr) : run_liburing(&lr) || run_raw_ring(&rr);
+        if (ret) {
+            return -1;
+        }
+        if (!r || lr.total_ns < liburing.total_ns) {
+            liburing = lr;
+        }
+        if (!r || rr.total_ns < raw.total_ns) {
+            raw = rr;
+        }
+    }
+    printf("%zu nops in batches of %u%s, best of %u rounds\n", ops, batch, sqpoll ? ", sqpoll" : "", rounds);
+    print_path(&liburing, ops);
+    print_path(&raw, ops);
+    printf("raw_ring/liburing total time %.3f\n", (double)raw.total_ns / liburing.total_ns);
+    return 0;
+}
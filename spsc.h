@@ -0,0 +1,76 @@
+/**
+ * bounded lock-free single-producer single-consumer queue of pointers.
+ *
+ * the producer owns tail, the consumer owns head, each on its own cache
+ * line. a slot is published by a release store of tail and claimed by an
+ * acquire load of it, and the other way around for head, so neither side
+ * ever takes a lock or a read-modify-write.
+ */
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdlib.h>
+
+#define SPSC_CACHE_LINE 64
+
+struct spsc_queue {
+    unsigned mask;                           // capacity - 1
+    void **slots;                            // ring of items
+    _Alignas(SPSC_CACHE_LINE) unsigned head; // next slot to pop, written by the consumer
+    _Alignas(SPSC_CACHE_LINE) unsigned tail; // next slot to push, written by the producer
+};
+
+/**
+ * capacity is rounded up to a power of two. returns -1 on allocation failure.
+ */
+static inline int spsc_init(struct spsc_queue *q, unsigned capacity) {
+    unsigned size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    q->head = q->tail = 0;
+    q->mask = size - 1;
+    q->slots = calloc(size, sizeof(void *));
+    return q->slots ? 0 : -1;
+}
+
+static inline void spsc_destroy(struct spsc_queue *q) {
+    free(q->slots);
+    q->slots = NULL;
+}
+
+/**
+ * producer side. returns -1 when the queue is full.
+ */
+static inline int spsc_push(struct spsc_queue *q, void *item) {
+    unsigned tail = q->tail;
+    if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) > q->mask) {
+        return -1;
+    }
+    q->slots[tail & q->mask] = item;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * consumer side, true when there is nothing to pop
+ */
+static inline int spsc_empty(struct spsc_queue *q) {
+    return q->head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * consumer side. returns NULL when the queue is empty.
+ */
+static inline void *spsc_pop(struct spsc_queue *q) {
+    unsigned head = q->head;
+    if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    void *item = q->slots[head & q->mask];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return item;
+}
+
+#endif